@@ -0,0 +1,138 @@
+#pragma once
+#include <buffer/upload.h>
+#include <commands.h>
+#include <config.h>
+#include <memory>
+#include <vector>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	// A range of bytes within one of the pages of a [geometry_arena].
+	struct arena_slice {
+		vk::Buffer buffer;
+		vk::DeviceSize offset;
+		vk::DeviceSize size;
+
+		uint32_t page;
+		VmaVirtualAllocation allocation;
+	};
+
+	/**
+	 * [mesh_range] describes a mesh that lives inside of a [geometry_arena].
+	 *
+	 * Meshes don't own any buffers, they're drawn with [firstIndex] and [vertexOffset] relative to the page they were
+	 * allocated in. Meshes that share the same pages can be drawn back to back without rebinding anything.
+	 */
+	struct mesh_range {
+		gfx::arena_slice vertices;
+		gfx::arena_slice indices;
+
+		uint32_t vertex_stride;
+		uint32_t index_count;
+		vk::IndexType index_type;
+
+		int32_t vertex_offset() const
+		{
+			return static_cast<int32_t>(vertices.offset / vertex_stride);
+		}
+
+		uint32_t first_index() const
+		{
+			return static_cast<uint32_t>(indices.offset / (index_type == vk::IndexType::eUint16 ? 2 : 4));
+		}
+
+		// Returns true if [other] can be drawn without rebinding the vertex and index buffers of this mesh.
+		bool shares_bindings(const gfx::mesh_range &other) const
+		{
+			return vertices.buffer == other.vertices.buffer
+				&& indices.buffer == other.indices.buffer
+				&& index_type == other.index_type;
+		}
+
+		void draw(vk::CommandBuffer *buffer, uint32_t instance_count = 1) const
+		{
+			buffer->drawIndexed(index_count, instance_count, first_index(), vertex_offset(), 0);
+		}
+	};
+
+	/**
+	 * [geometry_arena] manages a few large device-local vertex and index buffers ("pages"), and sub-allocates meshes from them
+	 * with VMA virtual blocks. This keeps the amount of buffers (and bindings) constant, regardless of how many meshes exist.
+	 *
+	 * A new page is created whenever an allocation doesn't fit in any of the existing ones.
+	 *
+	 * If the device supports direct writes, pages are placed in host-visible device-local memory and written to directly.
+	 * Otherwise, if an [uploader] is provided, mesh data is uploaded asynchronously, and if not it's uploaded immediately
+	 * with [commands::submit_and_wait].
+	 */
+	class geometry_arena
+	{
+	public:
+		geometry_arena(std::shared_ptr<gfx::device> device,
+			std::shared_ptr<gfx::commands> commands,
+			uint32_t vertex_stride,
+			vk::DeviceSize page_size = ARENA_PAGE_SIZE,
+			std::shared_ptr<gfx::uploader> uploader = nullptr);
+		~geometry_arena();
+
+		// Allocates room for [size] bytes of vertices, the offset is always a multiple of the vertex stride.
+		gfx::arena_slice allocate_vertices(vk::DeviceSize size);
+
+		// Allocates room for [size] bytes of indices of the given [type].
+		gfx::arena_slice allocate_indices(vk::DeviceSize size, vk::IndexType type);
+
+		void upload(const gfx::arena_slice &slice, const void *data);
+		void free(const gfx::arena_slice &slice);
+
+		gfx::mesh_range create_mesh(const void *vertices, size_t vertex_count, const void *indices, size_t index_count, vk::IndexType index_type);
+
+		template<class V, class I>
+		gfx::mesh_range create_mesh(const std::vector<V> &vertices, const std::vector<I> &indices)
+		{
+			static_assert(sizeof(I) == 2 || sizeof(I) == 4, "indices have to be either 16 or 32 bits wide!");
+
+			return create_mesh(vertices.data(), vertices.size(), indices.data(), indices.size(),
+				sizeof(I) == 2 ? vk::IndexType::eUint16 : vk::IndexType::eUint32);
+		}
+
+		void free_mesh(const gfx::mesh_range &mesh)
+		{
+			this->free(mesh.vertices);
+			this->free(mesh.indices);
+		}
+
+		uint32_t get_vertex_stride() const
+		{
+			return vertex_stride;
+		}
+
+	private:
+		struct page {
+			vk::Buffer buffer;
+			VmaAllocation allocation;
+			VmaVirtualBlock block;
+
+			// set if the page lives in host-visible device-local memory, in which case uploads are plain memcpys.
+			std::byte *mapped = nullptr;
+			bool coherent = true;
+		};
+
+		page &find_page(const gfx::arena_slice &slice);
+
+		gfx::arena_slice allocate(std::vector<page> &pages, vk::BufferUsageFlags usage, vk::DeviceSize size, vk::DeviceSize alignment);
+		page create_page(vk::BufferUsageFlags usage, vk::DeviceSize size);
+		void destroy_page(page &target);
+
+		std::shared_ptr<gfx::device> device;
+		std::shared_ptr<gfx::commands> commands;
+		std::shared_ptr<gfx::uploader> uploader;
+
+		uint32_t vertex_stride;
+		vk::DeviceSize page_size;
+
+		std::vector<page> vertex_pages;
+		std::vector<page> index_pages;
+	};
+}
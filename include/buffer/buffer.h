@@ -1,7 +1,10 @@
 #pragma once
 
+#include <buffer/upload.h>
 #include <commands.h>
+#include <map>
 #include <memory>
+#include <span>
 #include <stdexcept>
 #include <util.h>
 #include <vector>
@@ -20,9 +23,15 @@ namespace gfx
 		size_t size;
 		std::vector<vk::Buffer> buffers;
 
-		buffer(std::shared_ptr<gfx::device> device, std::shared_ptr<gfx::commands> commands, const T &data, size_t size, vk::BufferUsageFlags usage, vma::memory_usage memory_usage);
+		// if an [uploader] is provided, buffers with [eTransferDst] are uploaded asynchronously on the transfer queue.
+		// the buffer can't be used before the renderer has waited on the token returned by the next [uploader::flush].
+		buffer(std::shared_ptr<gfx::device> device, std::shared_ptr<gfx::commands> commands, const T &data, size_t size, vk::BufferUsageFlags usage, vma::memory_usage memory_usage, std::shared_ptr<gfx::uploader> uploader = nullptr);
 		~buffer();
 
+		// the defragmenter refers back to the buffer when it moves it, see [create_device_buffer].
+		buffer(const buffer &) = delete;
+		buffer &operator=(const buffer &) = delete;
+
 		void map(T &data, int frame = 0) const
 		{
 			if (this->data_mapped.size() < frame)
@@ -43,16 +52,50 @@ namespace gfx
 			return this->buffers[frame];
 		}
 
+		/**
+		 * Marks [bytes] at [offset] as dirty, without re-uploading the rest of the buffer.
+		 *
+		 * Host-visible buffers are written to immediately (the copy of [frame], for per-frame buffers), device-local buffers
+		 * keep the bytes around until the next [flush]. Overlapping and adjacent updates are merged, the latest one wins.
+		 */
+		void update(vk::DeviceSize offset, std::span<const std::byte> bytes, int frame = 0);
+
+		/**
+		 * Sends the dirty ranges of [frame] to the device.
+		 *
+		 * Host-visible buffers only flush those ranges (if the memory isn't coherent). Device-local buffers stage them and record
+		 * a single [copyBuffer] with one region per range into [command_buffer], this has to happen outside of a render pass.
+		 */
+		void flush(vk::CommandBuffer command_buffer, int frame = 0);
+
+		bool is_dirty(int frame = 0) const
+		{
+			return !pending.empty() || (static_cast<size_t>(frame) < dirty_ranges.size() && !dirty_ranges[frame].empty());
+		}
+
 	private:
-		void create_staging_buffer(const T &data, size_t size);
+		// Returns a pointer to the bytes described by [data], regardless of whether T is a pointer or a value type.
+		static const void *data_pointer(const T &data);
+
 		void create_device_buffer(vk::BufferUsageFlags usage, vma::memory_usage memory_usage);
-		void copy_data(vk::CommandBuffer commandBuffer);
+
+		// Tries allocating the buffer in host-visible device-local memory, and writes [data] straight into it.
+		// Returns false if there's no such memory left, in which case the buffer has to be uploaded instead.
+		bool create_direct_buffer(vk::BufferUsageFlags usage, const T &data);
+
+		void copy_data(vk::CommandBuffer command_buffer, const T &data);
 		void destroy();
 
 		std::shared_ptr<gfx::device> device;
 		std::shared_ptr<gfx::commands> commands;
 		std::vector<VmaAllocation> allocations;
 		std::vector<void *> data_mapped;
+
+		// the dirty ranges of each mapped buffer, as (offset, size) pairs.
+		std::vector<std::vector<std::pair<vk::DeviceSize, vk::DeviceSize>>> dirty_ranges;
+
+		// the bytes waiting to be uploaded to a device-local buffer, keyed by offset. these never overlap or touch.
+		std::map<vk::DeviceSize, std::vector<std::byte>> pending;
 	};
 
 	template class gfx::buffer<const gfx::vertex *>;
@@ -0,0 +1,101 @@
+#pragma once
+#include <functional>
+#include <optional>
+#include <timeline.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	class device;
+
+	/**
+	 * [defragmenter] runs VMA's defragmentation incrementally, a bounded amount of moves per frame.
+	 *
+	 * Only buffers registered with [track] are ever moved. For each of those, [step] creates a new buffer at the destination,
+	 * records the copy into the frame's command buffer and hands the new buffer to the owner's callback. The pass is
+	 * finished (and the old memory released) once the frame that recorded it has finished executing.
+	 *
+	 * Pages of a [buffer/arena.h->gfx->geometry_arena] aren't tracked, every [mesh_range] holds on to its page's handle.
+	 * Buffers that are still being uploaded to asynchronously are tracked, but not moved before a frame has waited on
+	 * their upload, see [hold] and [release].
+	 *
+	 * @see [device.h->gfx->device::get_defragmenter] - The device owns a single defragmenter.
+	 */
+	class defragmenter
+	{
+	public:
+		// When enabled, a new defragmentation is started [interval] frames after the previous one finished.
+		bool enabled = false;
+		uint32_t interval = 600;
+
+		// Bounds on the work done by a single pass, and thus a single frame.
+		uint32_t max_moves_per_pass = 64;
+		vk::DeviceSize max_bytes_per_pass = 16 * 1024 * 1024;
+
+		defragmenter(gfx::device *device);
+		~defragmenter();
+
+		// Registers [buffer], which may be moved. [on_moved] is called with the new buffer whenever it is, the owner has to
+		// use that one from then on. It's keyed by [allocation], which stays the same across moves.
+		// The buffer is copied from when it's moved, so [info] has to include [vk::BufferUsageFlagBits::eTransferSrc].
+		void track(VmaAllocation allocation, vk::Buffer buffer, const vk::BufferCreateInfo &info, std::function<void(vk::Buffer)> on_moved);
+
+		// Keeps a tracked buffer in place while an upload to it, finished at [upload], is in flight. The transfer may still
+		// be writing to the original buffer (or own it, on another queue family) until a frame has waited on it.
+		void hold(VmaAllocation allocation, gfx::timeline_point upload);
+
+		// Lets go of every buffer held by an upload up to [upload], once the frame being recorded waits on that point and
+		// has acquired its buffers. Moves recorded later in the same frame are ordered after the upload.
+		void release(gfx::timeline_point upload);
+
+		// Unregisters a buffer. Returns false if the allocation is being moved by the current pass, in which case the
+		// defragmenter takes ownership of the buffer and its allocation, and the caller must not destroy them.
+		bool untrack(VmaAllocation allocation);
+
+		// Starts a new defragmentation, if none is running.
+		void start();
+
+		// Finishes the previous pass if the GPU is done with it, and records the copies of the next one.
+		void step(vk::CommandBuffer command_buffer, uint32_t frame);
+
+		bool is_running() const
+		{
+			return context != nullptr;
+		}
+
+	private:
+		struct tracked_buffer {
+			vk::Buffer buffer;
+			vk::BufferCreateInfo info;
+			std::function<void(vk::Buffer)> on_moved;
+
+			// the upload that may still be writing to [buffer], see [hold].
+			std::optional<gfx::timeline_point> upload;
+		};
+
+		void begin_pass(vk::CommandBuffer command_buffer, uint32_t frame);
+		void end_pass();
+		void finish();
+
+		gfx::device *device;
+
+		std::unordered_map<VmaAllocation, tracked_buffer> tracked;
+
+		VmaDefragmentationContext context = nullptr;
+		VmaDefragmentationPassMoveInfo pass = {};
+
+		bool pass_pending = false;
+		uint32_t pass_frame = 0;
+		uint32_t idle_frames = 0;
+
+		// the moves of the current pass that we're actually copying, as their source allocation and index in the pass.
+		std::vector<std::pair<VmaAllocation, uint32_t>> pass_moves;
+
+		// buffers that can be destroyed once the current pass has finished.
+		std::vector<vk::Buffer> retired;
+	};
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <memory>
+#include <timeline.h>
+#include <utility>
+#include <vector>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	class device;
+
+	// A region handed out by [staging_ring::allocate]. [data] points into persistently mapped host memory,
+	// [buffer] and [offset] describe the same bytes for use as a copy source.
+	struct staging_region {
+		vk::Buffer buffer;
+		vk::DeviceSize offset;
+		vk::DeviceSize size;
+		void *data;
+	};
+
+	/**
+	 * [staging_ring] is a single, persistently mapped, host-visible buffer used as the source of all transfer uploads.
+	 *
+	 * Space is handed out linearly with [allocate], and every allocation made since the last [commit] is tagged with the
+	 * timeline value of the submission that reads from it. Regions are recycled once that value has been reached, so
+	 * uploading data only costs a memcpy and a copy command instead of a fresh VMA allocation per buffer.
+	 *
+	 * Regions can be tagged while their command buffer is still being recorded, with [commit_unsubmitted]. The ring never
+	 * waits on those until [mark_submitted] has been called for their point, as that would block forever. Whoever records
+	 * them registers a submitter for their timeline with [add_submitter], so any [allocate] can force them out.
+	 *
+	 * @see [device.h->gfx->device] - The device owns a single staging ring, accessible through [device::get_staging_ring].
+	 */
+	class staging_ring
+	{
+	public:
+		staging_ring(gfx::device *device, vk::DeviceSize capacity);
+		~staging_ring();
+
+		// Reserves [size] bytes in the ring. If the ring is full, this will first reclaim regions whose work has finished,
+		// and if that isn't enough it will block on the oldest pending submission. If that submission hasn't been
+		// submitted yet, the submitter of its timeline is called first.
+		gfx::staging_region allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+
+		// Registers [submit] for regions committed with [commit_unsubmitted] to a point of [timeline]. It has to submit
+		// the command buffer those regions belong to, and call [mark_submitted] for it.
+		void add_submitter(vk::Semaphore timeline, std::function<void()> submit);
+		void remove_submitter(vk::Semaphore timeline);
+
+		// Tags every region allocated since the previous commit with [point], which has already been submitted.
+		// The regions will be recycled once it has been reached.
+		void commit(gfx::timeline_point point);
+
+		// Like [commit], for a [point] whose submission is still being recorded, see [mark_submitted].
+		void commit_unsubmitted(gfx::timeline_point point);
+
+		// Marks the regions tagged with [point] (or an earlier value of the same timeline) as submitted, so they can be waited on.
+		void mark_submitted(gfx::timeline_point point);
+
+		// Releases every committed region whose timeline point has been reached.
+		void reclaim();
+
+		vk::Buffer get_buffer() const
+		{
+			return this->buffer;
+		}
+
+		vk::DeviceSize get_capacity() const
+		{
+			return this->capacity;
+		}
+
+	private:
+		struct pending_region {
+			gfx::timeline_point point;
+			vk::DeviceSize end; // the head of the ring at the time of the commit.
+			vk::DeviceSize bytes; // the amount of bytes consumed by the region, including alignment and wrap-around padding.
+			bool submitted; // false while the submission that signals [point] is still being recorded.
+		};
+
+		bool try_reserve(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &offset);
+		void wait_oldest();
+
+		gfx::device *device;
+
+		vk::Buffer buffer;
+		VmaAllocation allocation;
+		std::byte *mapped;
+
+		vk::DeviceSize capacity;
+		vk::DeviceSize head = 0; // the next byte that will be handed out.
+		vk::DeviceSize tail = 0; // the oldest byte that is still in use by the GPU.
+		vk::DeviceSize used = 0; // the amount of bytes between tail and head, including any padding.
+		vk::DeviceSize uncommitted = 0; // the amount of bytes allocated since the last commit.
+
+		std::deque<pending_region> pending;
+
+		// there's only ever a handful of timelines recording uploads, so a linear search is fine.
+		std::vector<std::pair<vk::Semaphore, std::function<void()>>> submitters;
+	};
+}
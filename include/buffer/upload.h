@@ -0,0 +1,77 @@
+#pragma once
+#include <device.h>
+#include <memory>
+#include <optional>
+#include <timeline.h>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	/**
+	 * [upload_token] is handed out by [uploader::flush], and signals the completion of a batch of uploads.
+	 *
+	 * The renderer has to wait on it (see [render.h->gfx->draw::wait_for]) before it can use any of the uploaded buffers.
+	 * This will wait for [point] on the GPU, and record [acquire_barriers] to take ownership of the buffers if they
+	 * were uploaded on a different queue family than the graphics family.
+	 */
+	struct upload_token {
+		gfx::timeline_point point;
+		std::vector<vk::BufferMemoryBarrier> acquire_barriers;
+	};
+
+	/**
+	 * [uploader] records buffer copies on the device's transfer queue, without ever waiting on the CPU.
+	 *
+	 * Data is staged through the device's [staging_ring] with [upload], and all uploads recorded since the last flush
+	 * are submitted at once with [flush]. Every batch signals the next value of the uploader's timeline. If the device has
+	 * a dedicated transfer family, the buffers are released to the graphics family on the transfer queue, and acquired
+	 * again when the renderer waits on the returned token.
+	 *
+	 * @see [device.h->gfx->device::transfer_queue] - The queue the uploads are submitted on.
+	 */
+	class uploader
+	{
+	public:
+		uploader(std::shared_ptr<gfx::device> device);
+		~uploader();
+
+		// Stages [size] bytes of [data] and records a copy into [destination] at [offset]. Returns the point of the batch
+		// the copy was recorded into, which is covered by the token of the next [flush].
+		gfx::timeline_point upload(vk::Buffer destination, vk::DeviceSize offset, const void *data, vk::DeviceSize size);
+
+		// Submits every upload recorded since the last flush. Returns std::nullopt if nothing was recorded.
+		std::optional<gfx::upload_token> flush();
+
+		// Recycles the command buffers of batches that have finished executing.
+		void collect();
+
+	private:
+		struct batch {
+			vk::CommandBuffer command_buffer;
+			uint64_t value; // the value of [timeline] this batch signals once it has finished.
+		};
+
+		void begin_batch();
+
+		// Submits the batch that's being recorded, its barriers are kept for the token of the next [flush]. This is also
+		// called by the staging ring, when it needs the space of the batch's uploads back.
+		void submit_batch();
+
+		std::shared_ptr<gfx::device> device;
+
+		vk::CommandPool command_pool;
+
+		// only a single batch is recorded at a time, so batches are always submitted in the order of their values.
+		gfx::timeline timeline;
+
+		std::optional<batch> recording;
+		std::vector<vk::BufferMemoryBarrier> recording_barriers;
+
+		// the value of the last batch submitted since the previous [flush].
+		std::optional<uint64_t> unflushed;
+
+		std::vector<batch> in_flight;
+		std::vector<batch> free_batches;
+	};
+}
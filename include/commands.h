@@ -1,5 +1,11 @@
 #pragma once
+#include <config.h>
+#include <deletion.h>
+#include <function_ref.h>
+#include <profiler.h>
+#include <statistics.h>
 #include <swapchain/swapchain.h>
+#include <timeline.h>
 
 namespace gfx
 {
@@ -9,13 +15,13 @@ namespace gfx
 	 *
 	 * [command_pool] is the pool of command buffers managed by this class.
 	 * [command_buffers] is a vector of command buffers allocated from the command pool.
-	 * [image_available_semaphores] and [render_finished_semaphores] are semaphores used for synchronization of rendering operations.
-	 * [in_flight_fences] are fences used for synchronization of CPU and GPU operations.
+	 * [image_available_semaphores] and [render_finished_semaphores] are semaphores used for synchronization with the swapchain.
+	 * [frame_timeline] is the timeline semaphore used for synchronization of CPU and GPU operations, frame N signals value N.
 	 *
 	 * The [commands] constructor takes a [gfx::device] object as input, and creates a command pool with a single command buffer.
 	 *
-	 * It is recommended to use one set of image available and render finished semaphores, and multiple fences for managing
-	 * synchronization between CPU and GPU operations.
+	 * The swapchain only works with binary semaphores, so those are still used for acquiring and presenting. Everything
+	 * else waits on timeline values, which never have to be reset.
 	 *
 	 * Please note that the [commands] class is not intended to be used for managing swap chains or window management.
 	 * For managing swap chains, consider using the [gfx::swapchain] class.
@@ -37,18 +43,37 @@ namespace gfx
 		// Each element of the vector corresponds to a render finished semaphore for a swapchain image.
 		std::vector<vk::Semaphore> render_finished_semaphores;
 
-		// A vector of fences used for synchronization of CPU and GPU operations.
-		// Each element of the vector corresponds to a fence for a swapchain image.
-		std::vector<vk::Fence> in_flight_fences;
+		// Signaled by the submission of every frame, with the number of that frame ([frame_count] at the time it began).
+		std::unique_ptr<gfx::timeline> frame_timeline;
 		uint32_t current_frame = 0;
 
+		// The amount of frames that have begun, [current_frame] only tells which frame slot is being recorded.
+		uint64_t frame_count = 0;
+
+		// Signaled by every submission of a one-shot command buffer, see [start_small_buffer].
+		std::unique_ptr<gfx::timeline> transient_timeline;
+
+		// The pool one-shot command buffers are allocated from, see [start_small_buffer].
+		vk::CommandPool transient_pool;
+
+		// Resources released while recording a frame are destroyed once the frame timeline has reached that frame.
+		std::unique_ptr<gfx::deletion_queue> deletion_queue;
+
+		// Measures the GPU time of every render pass and user scope, recorded into the frame's command buffer.
+		// The swapchain is handed a pointer to it, so its render passes can reach it.
+		std::unique_ptr<gfx::gpu_profiler> profiler;
+
+		// Counts the work of the pipelines drawn with each frame, only created by [enable_statistics].
+		std::unique_ptr<gfx::pipeline_statistics> statistics;
+
 		/**
 		 * Constructs a [commands] object using the specified [gfx::device].
 		 * A command pool with a single command buffer is created during construction.
 		 *
 		 * @param swaphcain A pointer to the [gfx::swapchain] object to be used for Vulkan API calls.
+		 * @param frames_in_flight The amount of frames that can be recorded ahead of the GPU, see [context::frames_in_flight].
 		 */
-		commands(std::shared_ptr<gfx::swapchain> swapchain, vk::SurfaceKHR *surface);
+		commands(std::shared_ptr<gfx::swapchain> swapchain, vk::SurfaceKHR *surface, uint32_t frames_in_flight);
 		~commands();
 
 		void cleanup();
@@ -57,15 +82,61 @@ namespace gfx
 		void initialize_command_buffers();
 		void create_sync_objects();
 
-		void submit_and_wait(const vk::CommandBuffer &command_buffer);
+		// Ends and submits a command buffer from [start_small_buffer], and waits for it to finish executing.
+		// Returns the (reached) timeline point of the submission, for tagging the staging regions it read from.
+		gfx::timeline_point submit_and_wait(const vk::CommandBuffer &command_buffer);
 		void begin(const vk::CommandBuffer &command_buffer);
-		void submit_nowait(std::function<void(vk::CommandBuffer &buffer)>);
 
+		// Ends the current frame without submitting its command buffer. The frame's timeline value is still signaled
+		// (by an empty submission), so nothing waiting on it blocks forever.
+		void skip_frame();
+
+		// Records [callback] into a one-shot command buffer and submits it, returns the point it signals once it's done.
+		gfx::timeline_point submit_nowait(gfx::function_ref<void(vk::CommandBuffer &buffer)> callback);
+
+		// Starts collecting pipeline statistics, see [swapchain/pipeline.h->gfx->pipeline::measure].
+		// Returns false if the device doesn't support them.
+		bool enable_statistics();
+
+		// Hands out a recycled one-shot command buffer from [transient_pool], which has already begun recording.
+		// One-shot command buffers signal [transient_timeline], so they never interfere with the frames in flight.
 		vk::CommandBuffer start_small_buffer();
 
+		// Returns the point the frame that is currently being recorded will signal once it has finished executing.
+		gfx::timeline_point get_frame_point() const
+		{
+			return frame_timeline->point(frame_timeline->get_value());
+		}
+
+		// The amount of frames in flight, per-frame structures that belong to these commands have to be sized for this.
+		uint32_t get_frames_in_flight() const
+		{
+			return frames_in_flight;
+		}
+
 	private:
+		struct transient_buffer {
+			vk::CommandBuffer buffer;
+			uint64_t value; // the value of [transient_timeline] the last submission of this buffer signals.
+		};
+
+		// Recycles every one-shot command buffer whose submission has finished.
+		void collect_transient();
+
+		// Submits [command_buffer], moves it from [transient_recording] to [transient_in_flight], and returns the point it signals.
+		gfx::timeline_point submit_transient(const vk::CommandBuffer &command_buffer);
+
+		std::vector<transient_buffer> transient_recording;
+		std::vector<transient_buffer> transient_in_flight;
+		std::vector<transient_buffer> transient_free;
+
 		std::shared_ptr<gfx::swapchain> swapchain;
 		std::shared_ptr<gfx::device> device;
 		vk::SurfaceKHR *surface;
+
+		uint32_t frames_in_flight;
+
+		// the frame each frame slot was last used by, which is the value to wait for before it can be used again.
+		std::vector<uint64_t> frame_values;
 	};
 }
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include <commands.h>
+#include <config.h>
 #include <device.h>
 #include <swapchain/swapchain.h>
 
@@ -30,7 +31,8 @@ namespace gfx
 	class context
 	{
 	public:
-		context();
+		// [frames_in_flight] is the amount of frames the CPU may record ahead of the GPU, between 1 and [MAX_FRAMES_IN_FLIGHT].
+		context(uint32_t frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT);
 		~context()
 		{
 			this->cleanup();
@@ -48,6 +50,9 @@ namespace gfx
 		std::shared_ptr<gfx::commands> commands = nullptr;
 		GLFWwindow *window;
 
+		// The amount of frames in flight every per-frame structure of this context is sized for.
+		const uint32_t frames_in_flight;
+
 	protected:
 		vk::DebugUtilsMessengerEXT debugger;
 
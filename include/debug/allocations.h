@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+
+namespace gfx::debug
+{
+	/**
+	 * Returns the amount of heap allocations made through the global [operator new] so far, on any thread.
+	 *
+	 * Allocations are only counted when building with the VX_ALLOCATION_TEST option, which replaces the global allocation
+	 * functions. Otherwise this always returns 0. Allocations VMA and the driver make for themselves don't go through it,
+	 * so they aren't counted.
+	 */
+	uint64_t allocation_count();
+
+	// Returns true if allocations are being counted, see [allocation_count].
+	constexpr bool counting_allocations()
+	{
+#ifdef VX_ALLOCATION_TEST
+		return true;
+#else
+		return false;
+#endif
+	}
+}
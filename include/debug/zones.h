@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace gfx::debug
+{
+	/**
+	 * [zone] records the CPU time between its construction and destruction under [name], while a capture is running.
+	 *
+	 * Every thread records into its own ring buffer, guarded by a lock of its own that's only contended while the capture
+	 * is being written, and recording never allocates once the thread's ring exists. When no capture is running, a zone
+	 * is a single atomic load. Use [VX_ZONE] rather than this class directly, so zones are compiled out of builds without
+	 * the VX_ZONES option.
+	 */
+	class zone
+	{
+	public:
+		// [name] has to outlive the capture, a string literal is best.
+		explicit zone(const char *name);
+		~zone();
+
+		zone(const zone &) = delete;
+		zone &operator=(const zone &) = delete;
+
+	private:
+		const char *name;
+		uint64_t begin; // nanoseconds since the process started, or 0 if no capture was running.
+	};
+
+	/**
+	 * Starts capturing zones for the next [frames] frames, after which the capture is written to [path] as Chrome
+	 * trace_event JSON (open it in chrome://tracing or ui.perfetto.dev).
+	 *
+	 * Frames are counted by [mark_frame], which [render.h->gfx->draw::begin] calls at the start of every frame, whether
+	 * it ends up being presented or not. Starting a capture while one is running restarts it.
+	 */
+	void capture_frames(uint32_t frames, const std::string &path);
+
+	// Marks the start of a new frame, and writes the capture once it has seen all of its frames.
+	void mark_frame();
+
+	// Returns true while a capture is running.
+	bool is_capturing();
+
+	// Writes every zone recorded since the capture began to [path]. Returns false if the file couldn't be written.
+	// Other threads may keep recording zones while this runs, those that end after their ring was copied are left out.
+	bool write_trace(const std::string &path);
+}
+
+#define VX_ZONE_CONCAT_INNER(a, b) a##b
+#define VX_ZONE_CONCAT(a, b) VX_ZONE_CONCAT_INNER(a, b)
+
+// Records the rest of the enclosing scope as a zone named [name], see [gfx::debug::zone].
+#ifdef VX_ZONES
+#define VX_ZONE(name) gfx::debug::zone VX_ZONE_CONCAT(vx_zone_, __LINE__) { name }
+#else
+#define VX_ZONE(name) ((void) 0)
+#endif
@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <device.h>
+#include <memory>
+#include <new>
+#include <timeline.h>
+#include <type_traits>
+#include <vector>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	/**
+	 * [deletion_queue] defers the destruction of resources until the GPU is guaranteed to be done with them.
+	 *
+	 * Every resource released while frame N is being recorded is tagged with frame N's value on the frame [timeline], and
+	 * destroyed by the first [collect] after the timeline has reached it. This makes it safe to release resources every
+	 * frame without calling [waitIdle] first.
+	 *
+	 * Deleters are stored inline in a ring that only grows when it's full, so once it has grown to the amount of resources
+	 * released per frame, pushing a deleter never allocates.
+	 *
+	 * @see [commands.h->gfx->commands::deletion_queue] - The queue tied to the frames of a [commands] object.
+	 */
+	class deletion_queue
+	{
+	public:
+		deletion_queue(std::shared_ptr<gfx::device> device, gfx::timeline *timeline)
+			: device { device }
+			, timeline { timeline }
+		{
+		}
+
+		~deletion_queue()
+		{
+			this->flush();
+		}
+
+		// The most a deleter may capture, which is enough for a few handles.
+		static constexpr size_t max_deleter_size = 4 * sizeof(void *);
+
+		// Defers [deleter] until the frame that is currently being recorded has finished executing. It's copied bytewise
+		// into the queue, so it can only capture plain values, like handles.
+		template<class F>
+		void push(F deleter)
+		{
+			static_assert(sizeof(F) <= max_deleter_size, "deleter captures too much to be stored inline");
+			static_assert(std::is_trivially_copyable_v<F>, "deleters can only capture plain values, like handles");
+
+			if (count == deleters.size())
+			{
+				this->grow();
+			}
+
+			pending_deleter &pending = deleters[(head + count++) % deleters.size()];
+
+			pending.value = timeline->get_value();
+			pending.invoke = [](void *storage) { (*std::launder(static_cast<F *>(storage)))(); };
+			new (pending.storage) F(deleter);
+		}
+
+		void destroy(vk::Buffer buffer, VmaAllocation allocation)
+		{
+			VmaAllocator allocator = device->get_vma_allocator();
+			this->push([=]() { vmaDestroyBuffer(allocator, buffer, allocation); });
+		}
+
+		template<class T>
+		void destroy(T handle)
+		{
+			vk::Device logical_device = device->get_logical_device();
+			this->push([=]() { logical_device.destroy(handle); });
+		}
+
+		// Runs the deleters of every frame the timeline has reached.
+		void collect()
+		{
+			// values are pushed in increasing order, so we can stop at the first one that hasn't been reached.
+			while (count > 0 && timeline->is_complete(deleters[head].value))
+			{
+				this->pop();
+			}
+		}
+
+		// Runs every deleter, regardless of the frame it belongs to. The device must be idle.
+		void flush()
+		{
+			while (count > 0)
+			{
+				this->pop();
+			}
+		}
+
+	private:
+		struct pending_deleter {
+			uint64_t value;
+			void (*invoke)(void *storage);
+			alignas(std::max_align_t) unsigned char storage[max_deleter_size];
+		};
+
+		// runs the oldest deleter, and removes it. it's copied out first, in case it releases something itself.
+		void pop()
+		{
+			pending_deleter pending = deleters[head];
+
+			this->head = (head + 1) % deleters.size();
+			this->count--;
+
+			pending.invoke(pending.storage);
+		}
+
+		// doubles the size of the ring, keeping the deleters in order.
+		void grow()
+		{
+			std::vector<pending_deleter> grown(std::max<size_t>(deleters.size() * 2, 64));
+
+			for (size_t i = 0; i < count; i++)
+			{
+				grown[i] = deleters[(head + i) % deleters.size()];
+			}
+
+			this->deleters = std::move(grown);
+			this->head = 0;
+		}
+
+		std::shared_ptr<gfx::device> device;
+		gfx::timeline *timeline;
+
+		std::vector<pending_deleter> deleters;
+		size_t head = 0;
+		size_t count = 0;
+	};
+}
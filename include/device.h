@@ -1,7 +1,14 @@
 #pragma once
+#include <buffer/defrag.h>
+#include <buffer/staging.h>
+#include <config.h>
 #include <functional>
 #include <global.h>
+#include <mutex>
 #include <optional>
+#include <set>
+#include <string>
+#include <swapchain/registry.h>
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan_core.h>
 #include <vulkan/vulkan_enums.hpp>
@@ -13,7 +20,29 @@ namespace gfx
 		VK_KHR_SWAPCHAIN_MUTABLE_FORMAT_EXTENSION_NAME,
 		VK_KHR_MAINTENANCE2_EXTENSION_NAME,
 		VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME,
-		// VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME,
+	};
+
+	// extensions that are enabled when the device supports them, but aren't required for it to be picked.
+	static const std::vector<const char *> optional_device_extensions = {
+		VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+		VK_KHR_PRESENT_ID_EXTENSION_NAME,
+		VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+		VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME,
+		VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME,
+	};
+
+	// A snapshot of the usage of a single memory heap, see [device::get_memory_statistics].
+	struct heap_statistics {
+		uint32_t heap;
+		vk::MemoryHeapFlags flags;
+
+		vk::DeviceSize usage; // the bytes used by this process, or an estimate if VK_EXT_memory_budget isn't available.
+		vk::DeviceSize budget; // the bytes this process can use before running into trouble.
+
+		uint32_t block_count; // the amount of VkDeviceMemory blocks allocated by VMA.
+		uint32_t allocation_count; // the amount of allocations sub-allocated from those blocks.
+		vk::DeviceSize block_bytes;
+		vk::DeviceSize allocation_bytes;
 	};
 
 	class device
@@ -22,6 +51,9 @@ namespace gfx
 		vk::Queue graphics_queue;
 		vk::Queue present_queue;
 
+		// the queue uploads are submitted on. this is the graphics queue if the device has no dedicated transfer family.
+		vk::Queue transfer_queue;
+
 		VmaAllocator allocator;
 
 		const vk::QueueFlags queue_flags = vk::QueueFlagBits::eGraphics;
@@ -38,6 +70,29 @@ namespace gfx
 
 		gfx::queue_family_indices find_queue_families(const vk::SurfaceKHR *surface, std::optional<vk::PhysicalDevice> device);
 
+		// Returns true if [extension] was enabled on the logical device, required or optional.
+		bool has_extension(const std::string &extension)
+		{
+			return enabled_extensions.contains(extension);
+		}
+
+		// Returns the usage and budget of every memory heap.
+		std::vector<gfx::heap_statistics> get_memory_statistics();
+
+		// Returns true if [size] more bytes fit in the heap of [memory_type] without going over [threshold] of its budget.
+		// Streaming code should check this before allocating, and back off instead of running out of device memory. The
+		// memory type of an allocation that's about to be made can be found with [vmaFindMemoryTypeIndexForBufferInfo].
+		bool has_budget_for(uint32_t memory_type, vk::DeviceSize size, float threshold = 0.9f);
+
+		// Returns VMA's statistics as JSON. [detailed] includes a map of every allocation.
+		std::string dump_memory_statistics(bool detailed = false);
+
+		// Lets VMA know a new frame has started, which is when it refreshes its budget.
+		void set_frame_index(uint32_t frame_index)
+		{
+			vmaSetCurrentFrameIndex(allocator, frame_index);
+		}
+
 		VmaAllocator get_vma_allocator()
 		{
 			return allocator;
@@ -53,11 +108,117 @@ namespace gfx
 			return physical_device;
 		}
 
+		gfx::queue_family_indices get_queue_families()
+		{
+			return queue_families;
+		}
+
+		bool has_dedicated_transfer()
+		{
+			return queue_families.transfer_family.has_value();
+		}
+
+		gfx::staging_ring *get_staging_ring()
+		{
+			return staging.get();
+		}
+
+		// Returns true if the device has memory that is both device-local and host-visible, backed by the main VRAM heap.
+		// This is the case on ReBAR GPUs, integrated GPUs and software rasterizers like lavapipe. Buffers allocated from
+		// it can be written to directly, without going through a staging copy.
+		bool supports_direct_write()
+		{
+			return direct_write_memory_types != 0;
+		}
+
+		// Returns a bitmask of the memory types usable for direct writes, meant for [VmaAllocationCreateInfo::memoryTypeBits].
+		uint32_t get_direct_write_memory_types()
+		{
+			return direct_write_memory_types;
+		}
+
+		gfx::defragmenter *get_defragmenter()
+		{
+			return defrag.get();
+		}
+
+		// Returns true if VK_KHR_present_id and VK_KHR_present_wait are enabled, and presents can be waited on.
+		bool supports_present_wait()
+		{
+			return wait_for_present != nullptr;
+		}
+
+		// Returns true if VK_EXT_graphics_pipeline_library is enabled, and pipelines can be linked from libraries.
+		bool supports_pipeline_library()
+		{
+			return pipeline_library;
+		}
+
+		// Returns true if the pipelineStatisticsQuery feature is enabled, and pipeline statistics queries can be used.
+		bool supports_pipeline_statistics()
+		{
+			return pipeline_statistics;
+		}
+
+		// Returns the cache every pipeline is created with. It's loaded from [PIPELINE_CACHE_PATH] when the device is
+		// created, if the file was written for the same device and driver.
+		vk::PipelineCache get_pipeline_cache()
+		{
+			return pipeline_cache;
+		}
+
+		// Returns true if the pipeline cache was loaded from disk, so pipelines shouldn't have to be compiled from scratch.
+		bool is_pipeline_cache_warm()
+		{
+			return pipeline_cache_warm;
+		}
+
+		// Returns the registry pipelines and pipeline layouts are shared through, see [swapchain/registry.h->gfx->pipeline_registry].
+		gfx::pipeline_registry *get_pipeline_registry()
+		{
+			return registry.get();
+		}
+
+		// Merges [cache] into the device's pipeline cache, for pipelines that were created with a cache of their own.
+		void merge_pipeline_cache(vk::PipelineCache cache);
+
+		// Writes the pipeline cache to [path]. It's written to a temporary file that then replaces [path], so a crash
+		// never leaves a partial cache behind. Returns false if it couldn't be written. This also happens on destruction.
+		bool save_pipeline_cache(const std::string &path = PIPELINE_CACHE_PATH);
+
+		// Waits until the present with [present_id] has been displayed, or [timeout] nanoseconds have passed.
+		vk::Result wait_for_present_khr(vk::SwapchainKHR chain, uint64_t present_id, uint64_t timeout)
+		{
+			return static_cast<vk::Result>(wait_for_present(logical_device, chain, present_id, timeout));
+		}
+
 	private:
 		float queue_priority = 1.0f;
 
 		vk::Device logical_device;
 		vk::PhysicalDevice physical_device;
+		gfx::queue_family_indices queue_families;
+		std::set<std::string> enabled_extensions;
+		uint32_t direct_write_memory_types = 0;
+		bool pipeline_statistics = false;
+		bool pipeline_library = false;
+
+		vk::PipelineCache pipeline_cache;
+		bool pipeline_cache_warm = false;
+
+		// merging into and reading from a pipeline cache have to be externally synchronized.
+		std::mutex pipeline_cache_mutex;
+
+		std::unique_ptr<gfx::pipeline_registry> registry;
+
+		// vkWaitForPresentKHR isn't exported by the loader, so it's loaded from the device if present waits are enabled.
+		PFN_vkWaitForPresentKHR wait_for_present = nullptr;
+
+		// the ring every transfer upload is staged through, see [buffer/staging.h->gfx->staging_ring].
+		std::unique_ptr<gfx::staging_ring> staging;
+
+		// moves device-local buffers around to keep the VMA pools from fragmenting, see [buffer/defrag.h->gfx->defragmenter].
+		std::unique_ptr<gfx::defragmenter> defrag;
 
 		std::optional<std::pair<vk::PhysicalDevice, gfx::queue_family_indices>> find_most_suitable(
 			const std::vector<vk::PhysicalDevice> device,
@@ -65,7 +226,12 @@ namespace gfx
 
 		uint32_t evaluate_device(vk::PhysicalDevice physical_device, gfx::queue_family_indices indices);
 
+		// Returns true if [physical_device] supports Vulkan 1.2 with the timelineSemaphore feature.
+		bool supports_timeline_semaphores(vk::PhysicalDevice physical_device);
+
 		void cleanup();
+		void load_pipeline_cache(const std::string &path);
 		void init_vma(const vk::Instance *instance);
+		void find_direct_write_memory();
 	};
 }
@@ -0,0 +1,41 @@
+#pragma once
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace gfx
+{
+	template<class Signature>
+	class function_ref;
+
+	/**
+	 * [function_ref] is a non-owning reference to a callable, like a [std::function] that never allocates.
+	 *
+	 * It's only a pointer to the callable and a pointer to a function that invokes it, so it's cheap to pass by value.
+	 * The callable has to outlive the [function_ref], which is always the case for a lambda passed straight to a function
+	 * that calls it before returning, like [render.h->gfx->draw::run].
+	 */
+	template<class R, class... Args>
+	class function_ref<R(Args...)>
+	{
+	public:
+		template<class F>
+			requires(!std::is_same_v<std::remove_cvref_t<F>, function_ref> && std::is_invocable_r_v<R, F &, Args...>)
+		function_ref(F &&callable) noexcept
+			: object { const_cast<void *>(static_cast<const void *>(std::addressof(callable))) }
+			, invoke { [](void *object, Args... args) -> R {
+				return (*static_cast<std::add_pointer_t<F>>(object))(std::forward<Args>(args)...);
+			} }
+		{
+		}
+
+		R operator()(Args... args) const
+		{
+			return invoke(object, std::forward<Args>(args)...);
+		}
+
+	private:
+		void *object;
+		R (*invoke)(void *object, Args... args);
+	};
+}
@@ -10,10 +10,30 @@ namespace gfx
 		std::optional<uint32_t> graphics_family;
 		std::optional<uint32_t> present_family;
 
+		// a queue family that supports transfers but not graphics, if the device has one.
+		// uploads fall back to the graphics family when this is empty.
+		std::optional<uint32_t> transfer_family;
+
 		bool is_complete()
 		{
 			return graphics_family.has_value() && present_family.has_value();
 		}
+
+		uint32_t get_transfer_family()
+		{
+			return transfer_family.value_or(graphics_family.value());
+		}
+	};
+
+	// How frames are handed to the display, see [swapchain.h->gfx->swapchain::policy].
+	enum class present_policy
+	{
+		// mailbox: no tearing, the newest frame is shown at every vblank. paced with present_wait when available.
+		low_latency,
+		// fifo (fifo_relaxed if available): every frame is shown, late frames tear instead of stalling for a whole vblank.
+		vsync,
+		// immediate: frames are shown as soon as they're done, tearing is allowed and nothing is paced.
+		throughput,
 	};
 
 	typedef vk::PresentModeKHR present_mode;
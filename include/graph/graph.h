@@ -0,0 +1,103 @@
+#pragma once
+#include <commands.h>
+#include <deletion.h>
+#include <device.h>
+#include <functional>
+#include <graph/pass.h>
+#include <graph/resource.h>
+#include <memory>
+#include <swapchain/swapchain.h>
+#include <vector>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	/**
+	 * [render_graph] records a frame from passes that declare the resources they read and write, instead of hand-written
+	 * render passes and synchronization.
+	 *
+	 * [compile] turns the declarations into Vulkan objects:
+	 *  - passes that don't contribute to an output (the swapchain, or anything marked with [mark_output]) are culled.
+	 *  - every pass gets a render pass whose load/store operations only keep what a later pass uses, and whose layout
+	 *    transitions and subpass dependencies cover the uses before and after it, so no separate barriers are needed.
+	 *  - transient attachments that are never alive at the same time share their memory.
+	 *
+	 * Passes run in the order they were added, which is always a valid order, as a pass can only depend on passes
+	 * added before it. The transient attachments are recreated when the swapchain is, the render passes are not, so
+	 * pipelines created for them stay valid.
+	 *
+	 * @see [graph/pass.h->gfx->graph_pass] - The declarations of a single pass.
+	 */
+	class render_graph
+	{
+	public:
+		// Called after the transient attachments have been (re)created, so descriptors that sample them can be updated.
+		std::function<void()> on_recreate;
+
+		render_graph(std::shared_ptr<gfx::swapchain> swapchain, std::shared_ptr<gfx::commands> commands);
+		~render_graph();
+
+		// Returns the resource standing in for the swapchain image that's being rendered to, it's always an output.
+		gfx::graph_resource import_swapchain();
+
+		// Creates a transient attachment with [format], sized [scale] times the swapchain's extent.
+		gfx::graph_resource create_attachment(const std::string &name, vk::Format format, float scale = 1.0f);
+
+		// Keeps [resource], and every pass it depends on, from being culled.
+		void mark_output(gfx::graph_resource resource);
+
+		// Adds a pass, which runs after every pass added before it. The reference stays valid for the graph's lifetime.
+		gfx::graph_pass &add_pass(const std::string &name);
+
+		// Culls and orders the passes, and creates their render passes and attachments. Throws if a pass uses a
+		// resource in a way that can't work, like reading an attachment nobody has written to.
+		void compile();
+
+		// Records every active pass into [buffer], rendering to swapchain image [image_index].
+		void execute(vk::CommandBuffer *buffer, uint32_t image_index);
+
+		// The view of a transient attachment, for sampling it. Changes when the swapchain is recreated, see [on_recreate].
+		vk::ImageView get_view(gfx::graph_resource resource) const
+		{
+			return images[resource].view;
+		}
+
+		void cleanup();
+
+	private:
+		// a block of memory shared by transient attachments whose lifetimes don't overlap.
+		struct memory_slot {
+			vk::MemoryRequirements requirements;
+			VmaAllocation allocation = nullptr;
+			uint32_t last_use = 0;
+		};
+
+		void cull();
+		void create_render_passes();
+
+		// Creates the transient attachments and framebuffers for the swapchain's current extent and images.
+		void create_resources();
+
+		// Hands the transient attachments and framebuffers to [deletion_queue].
+		void destroy_resources(gfx::deletion_queue *deletion_queue);
+
+		std::shared_ptr<gfx::device> device;
+		std::shared_ptr<gfx::swapchain> swapchain;
+		std::shared_ptr<gfx::commands> commands;
+
+		std::vector<gfx::graph_image> images;
+		std::vector<std::unique_ptr<gfx::graph_pass>> passes;
+
+		// the active passes, in the order they're executed.
+		std::vector<gfx::graph_pass *> order;
+
+		std::vector<memory_slot> slots;
+
+		std::optional<gfx::graph_resource> swapchain_resource;
+		bool compiled = false;
+
+		// the swapchain generation the resources were created for, see [swapchain.h->gfx->swapchain::generation].
+		uint64_t generation = 0;
+	};
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <functional>
+#include <graph/resource.h>
+#include <optional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	class render_graph;
+
+	/**
+	 * [graph_pass] is a single render pass of a [graph/graph.h->gfx->render_graph].
+	 *
+	 * A pass only declares the resources it reads and writes, and records its draws in [execute]. The graph creates the
+	 * Vulkan render pass and framebuffers for it, and derives its load/store operations, layout transitions and
+	 * dependencies from what the passes around it do with the same resources.
+	 *
+	 * The declarations are chained, like `graph.add_pass("main").read_depth(depth).write_color(color, clear)`.
+	 */
+	class graph_pass
+	{
+	public:
+		graph_pass(std::string name)
+			: name { std::move(name) }
+		{
+		}
+
+		// Renders to [resource] as a color attachment. It's cleared to [clear] first, or keeps its contents without one.
+		graph_pass &write_color(gfx::graph_resource resource, std::optional<vk::ClearColorValue> clear = std::nullopt);
+
+		// Renders to [resource] as the depth attachment. It's cleared to [clear] first, or keeps its contents without one.
+		graph_pass &write_depth(gfx::graph_resource resource, std::optional<vk::ClearDepthStencilValue> clear = std::nullopt);
+
+		// Depth tests against [resource] without writing to it, it has to be written by an earlier pass.
+		graph_pass &read_depth(gfx::graph_resource resource);
+
+		// Samples [resource] in fragment shaders, it has to be written by an earlier pass.
+		graph_pass &read(gfx::graph_resource resource);
+
+		// Sets the function that records the pass' draws, it's called within the render pass every frame.
+		graph_pass &execute(std::function<void(vk::CommandBuffer *buffer)> callback);
+
+		// Keeps the pass even if nothing reads what it writes.
+		graph_pass &keep();
+
+		// Records the pass' draws into secondary command buffers, [execute] may only execute those, for example with
+		// [parallel.h->gfx->parallel_recorder]. The viewport and scissor aren't set in the primary command buffer then.
+		graph_pass &record_secondary();
+
+		const std::string &get_name() const
+		{
+			return name;
+		}
+
+		// The render pass this pass is recorded in, pipelines used in [execute] have to be created for it.
+		// Only valid once the graph has been compiled.
+		vk::RenderPass get_render_pass() const
+		{
+			return pass;
+		}
+
+		// The framebuffer and extent the pass is rendering to, for inheriting the render pass in secondary command
+		// buffers. Only valid while the pass is being executed.
+		vk::Framebuffer get_framebuffer() const
+		{
+			return framebuffer;
+		}
+
+		vk::Extent2D get_extent() const
+		{
+			return extent;
+		}
+
+		// Returns false if the pass was culled by [render_graph::compile], because nothing uses what it writes.
+		bool is_active() const
+		{
+			return active;
+		}
+
+	private:
+		friend class render_graph;
+
+		struct use {
+			gfx::graph_resource resource;
+			gfx::resource_usage usage;
+			std::optional<vk::ClearValue> clear;
+		};
+
+		std::string name;
+		std::vector<use> uses;
+		std::function<void(vk::CommandBuffer *buffer)> callback;
+		bool side_effects = false;
+		vk::SubpassContents contents = vk::SubpassContents::eInline;
+
+		// these are filled in by [render_graph::compile].
+		bool active = false;
+		bool uses_swapchain = false;
+		float scale = 1.0f;
+
+		vk::RenderPass pass;
+		vk::Extent2D extent;
+
+		// one framebuffer per swapchain image if the pass renders to the swapchain, a single one otherwise.
+		std::vector<vk::Framebuffer> framebuffers;
+
+		// the framebuffer of the current execution, see [get_framebuffer].
+		vk::Framebuffer framebuffer;
+
+		// the resource and clear value of every attachment, in the order of the render pass' attachments.
+		std::vector<gfx::graph_resource> attachments;
+		std::vector<vk::ClearValue> clear_values;
+	};
+}
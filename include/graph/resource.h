@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	// A handle to an image in a [graph/graph.h->gfx->render_graph], handed out by the graph that owns it.
+	using graph_resource = uint32_t;
+
+	// How a pass uses a resource, this decides the layout, pipeline stages and access of the use.
+	enum class resource_usage
+	{
+		color_write, // rendered to as a color attachment.
+		depth_write, // rendered to as the depth attachment.
+		depth_read, // depth tested against, without writing to it (for example, after a depth prepass).
+		sampled, // read by fragment shaders, through a descriptor.
+	};
+
+	// The image layout, pipeline stages and access of a [resource_usage].
+	vk::ImageLayout get_layout(gfx::resource_usage usage);
+	vk::PipelineStageFlags get_stages(gfx::resource_usage usage);
+	vk::AccessFlags get_access(gfx::resource_usage usage);
+
+	// Returns true if [usage] only reads from the resource.
+	bool is_read(gfx::resource_usage usage);
+
+	/**
+	 * [graph_image] is an image the graph renders to, either one of the swapchain's images or a transient attachment.
+	 *
+	 * Transient attachments are created by the graph, sized relative to the swapchain. Attachments that are never alive
+	 * at the same time share their memory, see [render_graph::compile].
+	 */
+	struct graph_image {
+		std::string name;
+		vk::Format format;
+
+		// the size of the image, relative to the swapchain's extent.
+		float scale = 1.0f;
+
+		// true for the swapchain's images, which are owned by the swapchain and always kept.
+		bool imported = false;
+
+		// outputs are always kept, along with every pass that contributes to them.
+		bool output = false;
+
+		// these are filled in by [render_graph::compile].
+		vk::ImageUsageFlags usage;
+		vk::Image image;
+		vk::ImageView view;
+
+		// the first and last pass (in execution order) that use this image, and the memory slot it's aliased into.
+		uint32_t first_use = UINT32_MAX;
+		uint32_t last_use = 0;
+		uint32_t slot = UINT32_MAX;
+	};
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <commands.h>
+#include <condition_variable>
+#include <device.h>
+#include <exception>
+#include <function_ref.h>
+#include <graph/pass.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <swapchain/swapchain.h>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	/**
+	 * [parallel_recorder] records a render pass from multiple threads, using secondary command buffers.
+	 *
+	 * Every worker thread owns one [vk::CommandPool] per frame in flight, so recording never has to be synchronized between
+	 * threads. [record] splits a draw list into one contiguous slice per worker, each worker records its slice into a
+	 * secondary command buffer, and the primary command buffer executes all of them inside the render pass afterwards.
+	 *
+	 * The render pass has to be started with [vk::SubpassContents::eSecondaryCommandBuffers] for this to work, see
+	 * [swapchain.h->gfx->render_pass::begin] and [graph/pass.h->gfx->graph_pass::record_secondary].
+	 */
+	class parallel_recorder
+	{
+	public:
+		// The draw callback of a single worker, which records the draws in [first, last) into [buffer].
+		using record_callback = gfx::function_ref<void(vk::CommandBuffer *buffer, uint32_t first, uint32_t last)>;
+
+		// Starts [threads] worker threads, defaults to one per hardware thread.
+		parallel_recorder(std::shared_ptr<gfx::device> device, std::shared_ptr<gfx::commands> commands, uint32_t threads = std::thread::hardware_concurrency());
+		~parallel_recorder();
+
+		/**
+		 * Records [count] draws of [pass] in parallel, and executes them in [primary].
+		 *
+		 * [callback] is called once per worker from that worker's thread, with a secondary command buffer that has already
+		 * begun and has its viewport and scissor set. This function blocks until every worker is done recording.
+		 */
+		void record(vk::CommandBuffer *primary, gfx::render_pass &pass, uint32_t image_index, uint32_t count, record_callback callback);
+
+		// Records [count] draws of a [graph/pass.h->gfx->graph_pass] in parallel, this has to be called from its
+		// [graph_pass::execute] callback, and the pass has to be recorded with [graph_pass::record_secondary].
+		void record(vk::CommandBuffer *primary, const gfx::graph_pass &pass, uint32_t count, record_callback callback);
+
+		uint32_t get_thread_count() const
+		{
+			return static_cast<uint32_t>(workers.size());
+		}
+
+	private:
+		struct frame_pool {
+			vk::CommandPool pool;
+			std::vector<vk::CommandBuffer> buffers;
+
+			// the amount of [buffers] handed out since the pool was last reset.
+			uint32_t used = 0;
+
+			// the [commands::frame_count] the pool was last reset in.
+			uint64_t frame = UINT64_MAX;
+		};
+
+		struct worker {
+			std::thread thread;
+			std::vector<frame_pool> pools;
+
+			// the secondary command buffer recorded during the current job, if the slice wasn't empty.
+			vk::CommandBuffer recorded;
+			uint32_t first = 0;
+			uint32_t last = 0;
+		};
+
+		// hands a job to the workers, and waits for them to record it.
+		void record(vk::CommandBuffer *primary, vk::CommandBufferInheritanceInfo inheritance, vk::Extent2D extent, uint32_t count, record_callback callback);
+
+		void run(uint32_t index);
+		void record_slice(gfx::parallel_recorder::worker &worker);
+
+		vk::CommandBuffer next_buffer(gfx::parallel_recorder::frame_pool &pool);
+
+		std::shared_ptr<gfx::device> device;
+		std::shared_ptr<gfx::commands> commands;
+
+		std::vector<gfx::parallel_recorder::worker> workers;
+
+		// the secondary command buffers of the current job, kept around so recording doesn't allocate.
+		std::vector<vk::CommandBuffer> secondaries;
+
+		std::mutex mutex;
+		std::condition_variable job_ready;
+		std::condition_variable job_done;
+
+		// bumped for every job, so workers can tell a new job apart from a spurious wakeup.
+		uint64_t generation = 0;
+		uint32_t remaining = 0;
+		bool stopping = false;
+
+		// the state of the job that is currently being recorded.
+		std::optional<record_callback> callback;
+		vk::CommandBufferInheritanceInfo inheritance;
+		vk::Extent2D extent;
+		std::exception_ptr error;
+	};
+}
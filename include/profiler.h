@@ -0,0 +1,80 @@
+#pragma once
+#include <device.h>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	// The GPU time spent in every scope with the same name, during a single frame.
+	struct gpu_timing {
+		const char *name;
+		double milliseconds;
+	};
+
+	/**
+	 * [gpu_profiler] measures the GPU time of named scopes with timestamp queries.
+	 *
+	 * Every frame in flight has its own range of queries. The results of a frame are read back once its slot comes around
+	 * again, at which point the frame has finished executing, so reading them never blocks. Scopes have to be recorded into
+	 * the frame's primary command buffer, outside of render passes that execute secondary command buffers.
+	 *
+	 * Every [render_pass] is measured automatically under its name, see [swapchain.h->gfx->swapchain::profiler].
+	 */
+	class gpu_profiler
+	{
+	public:
+		// Returned by [begin_scope] if the scope isn't measured, because the profiler is disabled or out of queries.
+		static constexpr uint32_t invalid_scope = UINT32_MAX;
+
+		gpu_profiler(std::shared_ptr<gfx::device> device, uint32_t frames_in_flight, uint32_t max_scopes = 64);
+		~gpu_profiler();
+
+		// Reads back the results of the last frame that used [frame], and resets its queries. Called by [commands::begin].
+		void begin_frame(vk::CommandBuffer command_buffer, uint32_t frame);
+
+		// Writes the start timestamp of a scope. [name] has to outlive the profiler, a string literal is best.
+		uint32_t begin_scope(vk::CommandBuffer command_buffer, const char *name);
+		void end_scope(vk::CommandBuffer command_buffer, uint32_t scope);
+
+		// Returns the timings of the most recent frame that has been read back, one per scope name.
+		const std::vector<gfx::gpu_timing> &get_results() const
+		{
+			return results;
+		}
+
+		// Returns the milliseconds spent in the scopes named [name] in the most recent frame, or 0 if there were none.
+		double get_milliseconds(const char *name) const;
+
+		bool is_enabled() const
+		{
+			return enabled;
+		}
+
+	private:
+		struct scope {
+			const char *name;
+			uint32_t query; // the query of the start timestamp, the end timestamp is the next one.
+		};
+
+		void read_back(uint32_t frame);
+
+		std::shared_ptr<gfx::device> device;
+
+		vk::QueryPool pool;
+		bool enabled = false;
+
+		uint32_t max_scopes;
+		uint32_t current_frame = 0;
+
+		// nanoseconds per timestamp tick, and the bits of a timestamp that are valid.
+		double period;
+		uint64_t valid_mask;
+
+		// the scopes recorded in each frame slot, since it was last reset.
+		std::vector<std::vector<scope>> frame_scopes;
+
+		std::vector<uint64_t> timestamps;
+		std::vector<gfx::gpu_timing> results;
+	};
+}
@@ -1,9 +1,10 @@
 #pragma once
 
+#include <buffer/upload.h>
 #include <commands.h>
 #include <context.h>
 #include <device.h>
-#include <functional>
+#include <function_ref.h>
 #include <global.h>
 #include <swapchain/pipeline.h>
 #include <swapchain/swapchain.h>
@@ -16,10 +17,26 @@ namespace gfx
 		draw(std::shared_ptr<gfx::context> context);
 
 		void begin();
+
+		// Records the frame with [draw], and submits and presents it. [draw] is only referenced, so this never allocates.
 		void run(
-			std::function<void(vk::CommandBuffer *buffer, uint32_t image_index)> draw);
+			gfx::function_ref<void(vk::CommandBuffer *buffer, uint32_t image_index)> draw);
+
+		// Makes the next frame wait for the uploads of [token] before it touches any vertex or uniform data.
+		void wait_for(gfx::upload_token token);
 
 	private:
+		uint32_t frame_count = 0;
+
+		// tokens which still have to be waited on by the next submitted frame.
+		std::vector<gfx::upload_token> pending_uploads;
+
+		std::vector<vk::Semaphore> wait_semaphores;
+		std::vector<vk::PipelineStageFlags> wait_stages;
+
+		// the values of [wait_semaphores], these are ignored for binary semaphores.
+		std::vector<uint64_t> wait_values;
+
 		std::shared_ptr<gfx::device> device;
 		std::shared_ptr<gfx::context> context;
 		std::shared_ptr<gfx::commands> commands;
@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <device.h>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	// The pipeline statistics of every scope with the same name (usually a pipeline), during a single frame.
+	struct pipeline_counters {
+		const char *name;
+
+		uint64_t input_vertices; // vertices read by the input assembler.
+		uint64_t input_primitives; // primitives read by the input assembler.
+		uint64_t vertex_invocations;
+		uint64_t clipping_invocations; // primitives that reached the clipping stage.
+		uint64_t clipping_primitives; // primitives that came out of clipping, culled faces don't make it this far.
+		uint64_t fragment_invocations;
+	};
+
+	class pipeline_statistics;
+
+	/**
+	 * [statistics_scope] collects pipeline statistics from its construction until it goes out of scope.
+	 *
+	 * It has to be begun and ended in the same command buffer and subpass, so it's meant to live around the draws of a
+	 * single pipeline, see [swapchain/pipeline.h->gfx->pipeline::measure].
+	 */
+	class statistics_scope
+	{
+	public:
+		statistics_scope(gfx::pipeline_statistics *statistics, vk::CommandBuffer command_buffer, const char *name);
+		~statistics_scope();
+
+		statistics_scope(const statistics_scope &) = delete;
+		statistics_scope &operator=(const statistics_scope &) = delete;
+
+	private:
+		gfx::pipeline_statistics *statistics;
+		vk::CommandBuffer command_buffer;
+		uint32_t query;
+	};
+
+	/**
+	 * [pipeline_statistics] counts the vertices, primitives and shader invocations of named scopes with
+	 * VK_QUERY_TYPE_PIPELINE_STATISTICS queries, which makes overdraw and the effect of culling measurable.
+	 *
+	 * Like [profiler.h->gfx->gpu_profiler], every frame in flight has its own range of queries, which is read back once
+	 * its slot comes around again. Scopes may be recorded from several threads into the frame's secondary command buffers,
+	 * queries are handed out atomically. Scopes can't be nested within a single command buffer.
+	 *
+	 * This needs the pipelineStatisticsQuery feature, see [device.h->gfx->device::supports_pipeline_statistics].
+	 */
+	class pipeline_statistics
+	{
+	public:
+		// Returned by [begin] if the scope isn't counted, because there are no queries left in this frame.
+		static constexpr uint32_t invalid_scope = UINT32_MAX;
+
+		pipeline_statistics(std::shared_ptr<gfx::device> device, uint32_t frames_in_flight, uint32_t max_scopes = 64);
+		~pipeline_statistics();
+
+		// Reads back the counters of the last frame that used [frame], and resets its queries. Called by [commands::begin].
+		void begin_frame(vk::CommandBuffer command_buffer, uint32_t frame);
+
+		// Begins counting a scope. [name] has to outlive this object, see [statistics_scope] for doing this automatically.
+		uint32_t begin(vk::CommandBuffer command_buffer, const char *name);
+		void end(vk::CommandBuffer command_buffer, uint32_t scope);
+
+		// Returns a [statistics_scope] that counts everything recorded into [command_buffer] until it goes out of scope.
+		[[nodiscard]] gfx::statistics_scope measure(vk::CommandBuffer command_buffer, const char *name)
+		{
+			return gfx::statistics_scope { this, command_buffer, name };
+		}
+
+		// Returns the counters of the most recent frame that has been read back, one per scope name.
+		const std::vector<gfx::pipeline_counters> &get_results() const
+		{
+			return results;
+		}
+
+	private:
+		// the amount of counters each query writes, in the order of their bits in [statistic_flags].
+		static constexpr uint32_t counter_count = 6;
+		static constexpr vk::QueryPipelineStatisticFlags statistic_flags =
+			vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices
+			| vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives
+			| vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations
+			| vk::QueryPipelineStatisticFlagBits::eClippingInvocations
+			| vk::QueryPipelineStatisticFlagBits::eClippingPrimitives
+			| vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+
+		void read_back(uint32_t frame);
+
+		std::shared_ptr<gfx::device> device;
+
+		vk::QueryPool pool;
+
+		uint32_t max_scopes;
+		uint32_t current_frame = 0;
+
+		// the amount of scopes begun in [current_frame], and the name of every scope in each frame slot.
+		std::atomic<uint32_t> used { 0 };
+		std::vector<uint32_t> frame_used;
+		std::vector<const char *> names;
+
+		std::vector<uint64_t> counters;
+		std::vector<gfx::pipeline_counters> results;
+	};
+}
@@ -1,10 +1,17 @@
 #pragma once
 #include "uniform/layout.h"
+#include <buffer/arena.h>
 #include <buffer/buffer.h>
 #include <buffer/index.h>
+#include <deletion.h>
 #include <device.h>
+#include <future>
+#include <memory>
+#include <optional>
 #include <string>
+#include <swapchain/registry.h>
 #include <swapchain/swapchain.h>
+#include <thread_pool.h>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_handles.hpp>
@@ -21,7 +28,17 @@ namespace gfx
 		vk::Pipeline vk_pipeline; // The Vulkan pipeline handle.
 		vk::PipelineLayout pipeline_layout;
 
-		std::shared_ptr<gfx::render_pass> pass;
+		vk::RenderPass render_pass; // The render pass the pipeline is created for, it can be used with any compatible one.
+
+		// Set by [initialize_async]. If set, a pipeline built from libraries is fast-linked first and linked with link-time
+		// optimization in the background, otherwise it's linked with link-time optimization right away.
+		bool link_in_background = false;
+
+		// The depth test of the pipeline, it doesn't test depth if this isn't set.
+		std::optional<vk::PipelineDepthStencilStateCreateInfo> depth_stencil;
+
+		// The name this pipeline's statistics are collected under, its shaders by default.
+		std::string name;
 
 		std::vector<vk::DynamicState> dynamic_states = {
 			vk::DynamicState::eViewport, // The dynamic viewport state.
@@ -32,12 +49,18 @@ namespace gfx
 		std::vector<vk::VertexInputAttributeDescription> attribute_descriptions;
 		std::vector<vk::DescriptorSetLayout> layouts;
 
-		// The constructor for the pipeline class.
+		// The constructor for the pipeline class, for the swapchain's render pass named [parent_pass].
 		pipeline(std::shared_ptr<gfx::swapchain> swapchain,
 			const std::string &parent_pass,
 			const std::string vert_shader_name,
 			const std::string frag_shader_name);
 
+		// Creates a pipeline for [render_pass], like the render pass of a [graph/pass.h->gfx->graph_pass].
+		pipeline(std::shared_ptr<gfx::swapchain> swapchain,
+			vk::RenderPass render_pass,
+			const std::string vert_shader_name,
+			const std::string frag_shader_name);
+
 		// The destructor for the pipeline class.
 		~pipeline()
 		{
@@ -46,6 +69,10 @@ namespace gfx
 
 		void initialize();
 
+		// Reads the shaders and creates the pipeline on [pool]. The pipeline can't be used or changed until the returned
+		// future is ready, its [get] rethrows anything that went wrong.
+		std::future<void> initialize_async(gfx::thread_pool &pool);
+
 		void bind_uniform_layout(gfx::uniform_layout layout);
 
 		template<class T>
@@ -56,7 +83,43 @@ namespace gfx
 			vk::ArrayProxy<vk::Buffer> buffers = {},
 			vk::ArrayProxy<std::reference_wrapper<gfx::index_buffer<T>>> index_buffers = {},
 			vk::ArrayProxy<vk::DescriptorSet> descriptor_sets = {},
-			vk::ArrayProxy<const vk::DeviceSize> const &offsets = { 0 });
+			vk::ArrayProxy<const vk::DeviceSize> const &offsets = { 0 },
+			vk::ArrayProxy<const uint32_t> const &dynamic_offsets = {});
+
+		// Binds the pages [mesh] lives in. Any mesh that [mesh_range::shares_bindings] with it can be drawn afterwards
+		// without binding again.
+		void bind(vk::CommandBuffer *buffer,
+			const gfx::mesh_range &mesh,
+			vk::ArrayProxy<vk::DescriptorSet> descriptor_sets = {},
+			vk::ArrayProxy<const uint32_t> const &dynamic_offsets = {});
+
+		// Counts the work recorded into [buffer] with this pipeline, until the returned scope goes out of scope.
+		// This does nothing unless statistics are enabled, see [commands.h->gfx->commands::enable_statistics].
+		[[nodiscard]] gfx::statistics_scope measure(vk::CommandBuffer *buffer)
+		{
+			return gfx::statistics_scope { swapchain->statistics, *buffer, name.c_str() };
+		}
+
+		// Swaps in the optimized pipeline once its background link has finished, and hands the fast-linked one to
+		// [deletion_queue]. Returns true if it was swapped. This has to be called between frames, not while recording.
+		bool promote(gfx::deletion_queue *deletion_queue);
+
+		// Creates an uninitialized pipeline with the same shaders and state as this one, for rebuilding it.
+		std::unique_ptr<gfx::pipeline> create_replacement() const;
+
+		// Takes over the handles of [replacement], which has to be initialized, and hands this pipeline's old ones to
+		// [deletion_queue]. Returns false if this pipeline's optimized link is still running, and it can't be replaced yet.
+		bool replace_with(gfx::pipeline &replacement, gfx::deletion_queue *deletion_queue);
+
+		const std::string &get_vert_shader_name() const
+		{
+			return vert_shader_name;
+		}
+
+		const std::string &get_frag_shader_name() const
+		{
+			return frag_shader_name;
+		}
 
 		// This function cleans up the pipeline and releases any allocated resources.
 		void cleanup();
@@ -69,9 +132,40 @@ namespace gfx
 		void create_graphics_pipeline();
 
 	private:
+		/**
+		 * Builds the pipeline out of the four VK_EXT_graphics_pipeline_library parts (vertex input, pre-rasterization,
+		 * fragment shader and fragment output), which are compiled separately. With [link_in_background], the parts are
+		 * fast-linked into [vk_pipeline], and linked again with link-time optimization in the background.
+		 */
+		void create_from_libraries(const vk::GraphicsPipelineCreateInfo &info,
+			const vk::PipelineShaderStageCreateInfo &vertex_stage,
+			const vk::PipelineShaderStageCreateInfo &fragment_stage,
+			std::shared_ptr<std::promise<vk::Pipeline>> create);
+
+		vk::Pipeline link_libraries(vk::PipelineCreateFlags flags);
+		void destroy_libraries();
+
+		// Releases the pipeline's handles, through [deletion_queue] if there is one, otherwise right away.
+		void release(gfx::deletion_queue *deletion_queue);
+
+		// the parts the pipeline was linked from, kept until the optimized link is done.
+		std::vector<vk::Pipeline> libraries;
+		std::future<void> optimized;
+
+		// the pipeline used until the optimized link is done, it's never shared with other pipelines.
+		vk::Pipeline fast_linked;
+
+		// the [swapchain/registry.h->gfx->state_key] of the pipeline, and the pipeline with that state in the registry.
+		gfx::state_key state;
+		std::shared_future<vk::Pipeline> shared;
+
 		const std::string vert_shader_name;
 		const std::string frag_shader_name;
 		std::shared_ptr<gfx::device> device; // A pointer to the device object.
 		std::shared_ptr<gfx::swapchain> swapchain; // A pointer to the swapchain object.
 	};
+
+	// Builds every pipeline in [pipelines] in parallel on [pool], sharing the device's pipeline cache.
+	// Returns a future per pipeline, in the same order, which the renderer has to wait on before using them.
+	std::vector<std::future<void>> build_pipelines(gfx::thread_pool &pool, const std::vector<gfx::pipeline *> &pipelines);
 }
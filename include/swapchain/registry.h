@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	class device;
+	class deletion_queue;
+
+	/**
+	 * [state_key] holds everything a pipeline (or pipeline layout) is created from, as bytes, along with a 64-bit FNV-1a
+	 * hash of them. The hash only picks the bucket, keys are compared byte for byte, so a collision can't hand out the
+	 * pipeline of a different state.
+	 */
+	struct state_key {
+		std::vector<uint8_t> bytes;
+		uint64_t hash = 14695981039346656037ull;
+
+		state_key &add(const void *data, size_t size)
+		{
+			const auto *begin = static_cast<const uint8_t *>(data);
+
+			for (const auto *byte = begin; byte != begin + size; byte++)
+			{
+				this->hash = (hash ^ *byte) * 1099511628211ull;
+			}
+
+			bytes.insert(bytes.end(), begin, begin + size);
+			return *this;
+		}
+
+		// Adds the bytes of [value], only for types without padding or pointers (enums, flags, handles and the like).
+		template<class T>
+		state_key &add(const T &value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "only plain values can be hashed bytewise");
+			return this->add(&value, sizeof(T));
+		}
+
+		bool operator==(const state_key &other) const
+		{
+			return hash == other.hash && bytes == other.bytes;
+		}
+
+		struct hasher {
+			size_t operator()(const state_key &key) const
+			{
+				return static_cast<size_t>(key.hash);
+			}
+		};
+	};
+
+	// What [pipeline_registry::acquire] hands out for a pipeline state.
+	struct registered_pipeline {
+		// the pipeline with the requested state, which becomes ready once whoever creates it is done.
+		std::shared_future<vk::Pipeline> pipeline;
+
+		// only set for the first request of a state, the caller has to create the pipeline and fulfil this, either with
+		// the pipeline or with the exception that kept it from being created.
+		std::shared_ptr<std::promise<vk::Pipeline>> create;
+	};
+
+	/**
+	 * [pipeline_registry] deduplicates pipelines and pipeline layouts, so pipelines with the same state are only
+	 * compiled once and share a single handle.
+	 *
+	 * Pipelines are keyed by a [state_key] of their full state: the SPIR-V of their shaders, vertex bindings and
+	 * attributes, rasterization, blend and depth state, their layout and their render pass. Both pipelines and layouts
+	 * are reference counted, and destroyed once their last user releases them.
+	 *
+	 * The registry is thread-safe, pipelines built in parallel (see [swapchain/pipeline.h->gfx->build_pipelines]) with
+	 * the same state wait for the first one instead of compiling it again.
+	 */
+	class pipeline_registry
+	{
+	public:
+		pipeline_registry(gfx::device *device);
+		~pipeline_registry();
+
+		// Adds a reference to the pipeline with [state]. If there's none yet, the returned [registered_pipeline::create]
+		// is set and the caller has to create it.
+		gfx::registered_pipeline acquire(const gfx::state_key &state);
+
+		// Drops a reference to the pipeline with [state], it's destroyed along with the last one. With a
+		// [deletion_queue] that happens once the GPU is done with the current frame, otherwise it happens right away.
+		void release(const gfx::state_key &state, gfx::deletion_queue *deletion_queue = nullptr);
+
+		// Returns the pipeline layout for [info], creating it if no pipeline uses an identical one yet.
+		vk::PipelineLayout acquire_layout(const vk::PipelineLayoutCreateInfo &info);
+
+		// Drops a reference to [layout], see [release].
+		void release_layout(vk::PipelineLayout layout, gfx::deletion_queue *deletion_queue = nullptr);
+
+	private:
+		struct pipeline_entry {
+			std::shared_future<vk::Pipeline> pipeline;
+			uint32_t references = 0;
+		};
+
+		struct layout_entry {
+			vk::PipelineLayout layout;
+			uint32_t references = 0;
+		};
+
+		gfx::device *device;
+
+		std::mutex mutex;
+		std::unordered_map<gfx::state_key, pipeline_entry, gfx::state_key::hasher> pipelines;
+		std::unordered_map<gfx::state_key, layout_entry, gfx::state_key::hasher> layouts;
+
+		// destroys the pipeline of [entry], if it was created at all.
+		void destroy(const pipeline_entry &entry, gfx::deletion_queue *deletion_queue);
+	};
+}
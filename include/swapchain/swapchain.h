@@ -1,12 +1,16 @@
 #pragma once
 
+#include <string>
 #include <unordered_map>
 #define GLFW_INCLUDE_VULKAN
 
 #include <GLFW/glfw3.h>
+#include <deletion.h>
 #include <device.h>
 #include <functional>
 #include <global.h>
+#include <profiler.h>
+#include <statistics.h>
 #include <vulkan/vulkan.hpp>
 
 namespace gfx
@@ -55,15 +59,30 @@ namespace gfx
 		vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined;
 		vk::ImageLayout final_layout = vk::ImageLayout::ePresentSrcKHR;
 
-		void begin(vk::CommandBuffer *buffer, uint32_t index, vk::ClearValue clear);
+		// The name the pass is profiled under, set to its key by [swapchain::add_render_pass].
+		std::string name = "render pass";
+
+		// Begins the render pass on framebuffer [index]. With [vk::SubpassContents::eSecondaryCommandBuffers], the pass can
+		// only be recorded into by secondary command buffers, see [parallel.h->gfx->parallel_recorder].
+		// The GPU time between [begin] and [end] is measured by the swapchain's [profiler], if it has one.
+		void begin(vk::CommandBuffer *buffer, uint32_t index, vk::ClearValue clear, vk::SubpassContents contents = vk::SubpassContents::eInline);
 		void end(vk::CommandBuffer *buffer);
 
+		// Sets the viewport and scissor to cover the whole swapchain extent.
+		void set_viewport(vk::CommandBuffer *buffer);
+
+		// The extent of the framebuffers, which is always the swapchain's extent.
+		vk::Extent2D get_extent() const;
+
 		// This function creates the Vulkan render pass for the pipeline.
 		void create_render_pass();
 
 		// This function creates the Vulkan framebuffers for the pipeline.
 		void create_frame_buffers();
 
+		// Hands the current framebuffers to [deletion_queue], and creates new ones for the swapchain's current images.
+		void recreate_frame_buffers(gfx::deletion_queue *deletion_queue);
+
 		// This function cleans up resources used by the render pass and its framebuffers.
 		void cleanup();
 
@@ -81,6 +100,9 @@ namespace gfx
 		// The parent swapchain and device the render pass belongs to.
 		std::shared_ptr<gfx::swapchain> swapchain;
 		std::shared_ptr<gfx::device> device;
+
+		// the profiler scope opened by [begin], it's closed by [end].
+		uint32_t profiler_scope = gfx::gpu_profiler::invalid_scope;
 	};
 
 	/**
@@ -128,6 +150,12 @@ namespace gfx
 
 		std::shared_ptr<gfx::device> device; // The device associated with the swapchain.
 
+		// Set when the surface has changed (for example, the window was resized), the swapchain is recreated before the next frame.
+		bool out_of_date = false;
+
+		// Incremented every time the swapchain is recreated, objects sized for its images recreate theirs when it changes.
+		uint64_t generation = 0;
+
 		// Function for choosing a swap surface format.
 		std::function<gfx::surface_format(gfx::surface_formats &available_formats)> choose_swap_surface = [](gfx::surface_formats &available_formats) {
 			// Chooses the first available format that matches the desired format.
@@ -143,24 +171,65 @@ namespace gfx
 			return available_formats[0];
 		};
 
-		// Function for choosing a present mode.
-		std::function<gfx::present_mode(const gfx::present_modes &available_present_modes)> choose_present_mode = [](const gfx::present_modes &available_present_modes) {
-			// Default present mode if no other is chosen.
-			return gfx::present_mode::eImmediate;
-		};
+		// How frames are presented, this picks the present mode and the amount of images. Takes effect on (re)creation.
+		gfx::present_policy policy = gfx::present_policy::low_latency;
+
+		// The amount of presents that may be queued up for the display before [wait_for_present] blocks, when paced.
+		uint32_t max_queued_presents = 1;
+
+		// The id of the last present, only used if the device supports present waits.
+		uint64_t present_id = 0;
+
+		// Function for choosing a present mode. If set, this overrides the present mode picked by [policy].
+		std::function<gfx::present_mode(const gfx::present_modes &available_present_modes)> choose_present_mode;
+
+		// Measures the GPU time of every render pass, owned by [commands.h->gfx->commands::profiler]. May be null.
+		gfx::gpu_profiler *profiler = nullptr;
+
+		// Counts the work of every pipeline that's measured, see [commands.h->gfx->commands::enable_statistics]. May be null.
+		gfx::pipeline_statistics *statistics = nullptr;
 
 		// Initializes the swapchain object.
 		void initialize(GLFWwindow *window, vk::SurfaceKHR &surface);
 
+		/**
+		 * Recreates the swapchain for the current size of the surface, along with the framebuffers of every render pass.
+		 *
+		 * The old swapchain is passed to the new one as [oldSwapchain]. Before it's retired, this waits for its last present
+		 * to be done (with VK_KHR_present_wait, otherwise for the present queue to be idle), as the presentation engine may
+		 * still be reading from its images. It's then destroyed (with its image views and framebuffers) through
+		 * [deletion_queue] once the frames that may still render to it have finished, instead of waiting for the device to
+		 * be idle.
+		 *
+		 * Returns false if the surface has no area (the window is minimized), in which case nothing can be rendered until
+		 * it has been recreated successfully.
+		 */
+		bool recreate(gfx::deletion_queue *deletion_queue);
+
 		void add_render_pass(std::string key, gfx::render_pass pass)
 		{
+			pass.name = key;
 			this->render_passes.try_emplace(key, pass);
 		}
 
 		void cleanup();
 
-		// Creates the swapchain object.
-		void create_swapchain(vk::SurfaceKHR &surface, gfx::swapchain_support_details details);
+		/**
+		 * Sleeps until the display has caught up to at most [max_queued_presents] presents behind the latest one.
+		 *
+		 * This is called right before a frame starts recording, so its input is sampled as late as possible. It does
+		 * nothing with the throughput policy, or if the device doesn't support VK_KHR_present_wait.
+		 */
+		void wait_for_present();
+
+		// Returns the present mode [policy] prefers out of [available_present_modes].
+		gfx::present_mode select_present_mode(const gfx::present_modes &available_present_modes);
+
+		// Returns the amount of images to create for [present_mode], within the limits of [capabilities].
+		uint32_t select_image_count(const vk::SurfaceCapabilitiesKHR &capabilities, gfx::present_mode present_mode);
+
+		// Creates the swapchain object, replacing [old_chain] if there is one.
+		void create_swapchain(vk::SurfaceKHR &surface, gfx::swapchain_support_details details, vk::SwapchainKHR old_chain = nullptr);
 
 		void create_image_views();
 
@@ -175,5 +244,13 @@ namespace gfx
 
 	protected:
 		friend class render_pass;
+
+	private:
+		// The window and surface the swapchain was initialized for, used for recreating it.
+		GLFWwindow *window = nullptr;
+		vk::SurfaceKHR *surface = nullptr;
+
+		// The first present id used with the current swapchain, ids of an older swapchain can't be waited on.
+		uint64_t first_present_id = 1;
 	};
 }
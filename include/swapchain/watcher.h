@@ -0,0 +1,75 @@
+#pragma once
+#include <deletion.h>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <swapchain/pipeline.h>
+#include <thread_pool.h>
+#include <unordered_map>
+#include <vector>
+
+namespace gfx
+{
+	/**
+	 * [shader_watcher] hot-reloads pipelines when the SPIR-V of their shaders changes on disk.
+	 *
+	 * Changes are picked up with inotify (so only on Linux, it does nothing elsewhere) by [update], which the render loop
+	 * calls between frames. A changed pipeline is rebuilt on the thread pool, from a copy made with
+	 * [pipeline::create_replacement], while the old one keeps being used. Once the rebuild is done, the next [update]
+	 * swaps it in, and the old pipeline is retired through the deletion queue once the GPU is done with it. A shader
+	 * that fails to build is logged, and the pipeline keeps its old one.
+	 *
+	 * Watched pipelines have to outlive the watcher, and must be fully initialized before they're watched.
+	 */
+	class shader_watcher
+	{
+	public:
+		shader_watcher(gfx::thread_pool &pool);
+
+		// Waits for rebuilds that are still running, and stops watching.
+		~shader_watcher();
+
+		// Rebuilds [pipeline] whenever its vertex or fragment shader changes.
+		void watch(gfx::pipeline *pipeline);
+
+		// Starts rebuilding the pipelines whose shaders have changed, and swaps in the ones that are done rebuilding,
+		// handing the old ones to [deletion_queue]. This has to be called between frames, not while recording.
+		void update(gfx::deletion_queue *deletion_queue);
+
+	private:
+		struct watched_pipeline {
+			gfx::pipeline *pipeline;
+			std::filesystem::path vert_shader;
+			std::filesystem::path frag_shader;
+		};
+
+		struct rebuild {
+			std::unique_ptr<gfx::pipeline> replacement;
+			std::future<void> ready;
+
+			// set if the shaders changed again while the rebuild was running, so it has to be rebuilt once more.
+			bool again = false;
+		};
+
+		// starts rebuilding [pipeline] on the pool, unless it's already being rebuilt.
+		void start_rebuild(gfx::pipeline *pipeline);
+
+		// builds a replacement for [pipeline] on the pool, into [pending].
+		void submit_rebuild(gfx::pipeline *pipeline, rebuild &pending);
+
+		// watches the directory [file] is in, if it isn't watched yet.
+		void watch_directory(const std::filesystem::path &file);
+
+		gfx::thread_pool &pool;
+
+		std::vector<watched_pipeline> pipelines;
+		std::unordered_map<gfx::pipeline *, rebuild> rebuilds;
+
+		// the inotify instance, and the directory of every watch descriptor.
+		int inotify = -1;
+		std::unordered_map<int, std::filesystem::path> directories;
+
+		// events are read into this, it's allocated once so polling doesn't allocate every frame.
+		std::vector<char> events;
+	};
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace gfx
+{
+	/**
+	 * [thread_pool] runs jobs on a fixed set of worker threads, for long-running work that shouldn't block the main thread,
+	 * like compiling pipelines (see [swapchain/pipeline.h->gfx->build_pipelines]).
+	 *
+	 * Jobs are run in the order they were submitted, and every job hands out a [std::future] for its result. Exceptions
+	 * thrown by a job are rethrown by [std::future::get]. Unlike [parallel.h->gfx->parallel_recorder], this isn't meant to
+	 * be used within a frame, submitting allocates.
+	 */
+	class thread_pool
+	{
+	public:
+		// Starts [threads] worker threads, defaults to one per hardware thread.
+		thread_pool(uint32_t threads = std::thread::hardware_concurrency());
+
+		// Runs every job that's still queued, and joins the worker threads.
+		~thread_pool();
+
+		// Queues [job], and returns a future for its result.
+		template<class F>
+		std::future<std::invoke_result_t<F>> submit(F &&job)
+		{
+			using result = std::invoke_result_t<F>;
+
+			// std::function has to be copyable, so the (move-only) task is shared.
+			auto task = std::make_shared<std::packaged_task<result()>>(std::forward<F>(job));
+			std::future<result> future = task->get_future();
+
+			{
+				std::lock_guard lock(mutex);
+				jobs.push_back([task]() { (*task)(); });
+			}
+
+			job_ready.notify_one();
+			return future;
+		}
+
+		uint32_t get_thread_count() const
+		{
+			return static_cast<uint32_t>(threads.size());
+		}
+
+	private:
+		void run();
+
+		std::vector<std::thread> threads;
+		std::deque<std::function<void()>> jobs;
+
+		std::mutex mutex;
+		std::condition_variable job_ready;
+		bool stopping = false;
+	};
+}
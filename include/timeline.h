@@ -0,0 +1,106 @@
+#pragma once
+#include <algorithm>
+#include <stdexcept>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	// A value on a timeline semaphore. The work it refers to has finished once the semaphore has reached [value].
+	struct timeline_point {
+		vk::Semaphore semaphore;
+		uint64_t value;
+
+		bool is_complete(vk::Device device) const
+		{
+			return device.getSemaphoreCounterValue(semaphore) >= value;
+		}
+
+		void wait(vk::Device device) const
+		{
+			vk::SemaphoreWaitInfo wait_info { {}, 1, &semaphore, &value };
+
+			if (device.waitSemaphores(wait_info, UINT64_MAX) != vk::Result::eSuccess)
+			{
+				throw std::runtime_error("unable to wait for timeline semaphore!");
+			}
+		}
+	};
+
+	/**
+	 * [timeline] wraps a single timeline semaphore, which is signaled with a monotonically increasing value by every
+	 * submission made through it.
+	 *
+	 * A value is handed out with [next] before the submission that signals it, so work can be tagged with it while it's
+	 * still being recorded. Values have to be submitted in the order they were handed out.
+	 */
+	class timeline
+	{
+	public:
+		timeline(vk::Device device)
+			: device { device }
+		{
+			vk::SemaphoreTypeCreateInfo type_info { vk::SemaphoreType::eTimeline, 0 };
+			this->semaphore = device.createSemaphore(vk::SemaphoreCreateInfo { {}, &type_info });
+		}
+
+		~timeline()
+		{
+			device.destroySemaphore(semaphore);
+		}
+
+		timeline(const timeline &) = delete;
+		timeline &operator=(const timeline &) = delete;
+
+		// Hands out the value the next submission will signal.
+		uint64_t next()
+		{
+			return ++value;
+		}
+
+		// Returns the last value that was handed out.
+		uint64_t get_value() const
+		{
+			return value;
+		}
+
+		gfx::timeline_point point(uint64_t value) const
+		{
+			return gfx::timeline_point { semaphore, value };
+		}
+
+		bool is_complete(uint64_t value)
+		{
+			if (value > completed)
+			{
+				this->completed = device.getSemaphoreCounterValue(semaphore);
+			}
+
+			return value <= completed;
+		}
+
+		void wait(uint64_t value)
+		{
+			if (this->is_complete(value))
+			{
+				return;
+			}
+
+			this->point(value).wait(device);
+			this->completed = std::max(completed, value);
+		}
+
+		vk::Semaphore get_semaphore() const
+		{
+			return semaphore;
+		}
+
+	private:
+		vk::Device device;
+		vk::Semaphore semaphore;
+
+		uint64_t value = 0;
+
+		// the last value we've seen the semaphore reach, so finished work doesn't have to query the device again.
+		uint64_t completed = 0;
+	};
+}
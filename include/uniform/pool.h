@@ -1,5 +1,4 @@
 #pragma once
-#include <config.h>
 #include <device.h>
 #include <stdexcept>
 #include <uniform/layout.h>
@@ -12,9 +11,11 @@ namespace gfx
 	class descriptor_pool
 	{
 	public:
-		descriptor_pool(std::shared_ptr<gfx::device> device, vk::DescriptorType type)
+		// The pool holds one set per frame in flight, [frames_in_flight] has to match the [commands] the sets are used with.
+		descriptor_pool(std::shared_ptr<gfx::device> device, vk::DescriptorType type, uint32_t frames_in_flight)
 			: type { type }
 			, device { device }
+			, frames_in_flight { frames_in_flight }
 		{
 			this->create_pool();
 		};
@@ -27,12 +28,12 @@ namespace gfx
 		std::vector<vk::DescriptorSet> create_descriptor_sets(gfx::uniform_layout layout)
 		{
 			spdlog::info("create descriptor sets");
-			std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, layout.layout);
-			std::vector<vk::DescriptorSet> sets(MAX_FRAMES_IN_FLIGHT);
+			std::vector<vk::DescriptorSetLayout> layouts(frames_in_flight, layout.layout);
+			std::vector<vk::DescriptorSet> sets(frames_in_flight);
 
 			vk::DescriptorSetAllocateInfo allocate {
 				this->pool,
-				static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+				frames_in_flight,
 				layouts.data()
 			};
 
@@ -47,16 +48,33 @@ namespace gfx
 			return sets;
 		}
 
+		// Allocates a single set, used for descriptors that are shared by every frame (like [eUniformBufferDynamic]).
+		vk::DescriptorSet create_descriptor_set(gfx::uniform_layout layout)
+		{
+			vk::DescriptorSet set;
+			vk::DescriptorSetAllocateInfo allocate { this->pool, 1, &layout.layout };
+
+			auto result = device->get_logical_device().allocateDescriptorSets(&allocate, &set);
+
+			if (result != vk::Result::eSuccess)
+			{
+				throw std::runtime_error("error while allocating descriptor set!");
+			}
+
+			return set;
+		}
+
 		std::shared_ptr<gfx::device> device;
 
 	private:
 		vk::DescriptorType type;
 		vk::DescriptorPool pool;
+		uint32_t frames_in_flight;
 
 		void create_pool()
 		{
-			vk::DescriptorPoolSize size { type, MAX_FRAMES_IN_FLIGHT };
-			vk::DescriptorPoolCreateInfo info { {}, MAX_FRAMES_IN_FLIGHT, 1, &size };
+			vk::DescriptorPoolSize size { type, frames_in_flight };
+			vk::DescriptorPoolCreateInfo info { {}, frames_in_flight, 1, &size };
 
 			this->pool = device->get_logical_device().createDescriptorPool(info);
 		}
@@ -0,0 +1,130 @@
+#pragma once
+#include <config.h>
+#include <device.h>
+#include <memory>
+#include <stdexcept>
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.hpp>
+
+namespace gfx
+{
+	/**
+	 * [uniform_ring] is a single persistently mapped uniform buffer, split in one region per frame in flight.
+	 *
+	 * Uniform data is bump-allocated from the current frame's region with [push], which returns the dynamic offset to bind it with.
+	 * Every draw can have its own uniforms this way, while all of them share one buffer and one [eUniformBufferDynamic] descriptor.
+	 *
+	 * @see [uniform/pool.h->gfx->descriptor_pool::create_descriptor_set] - For allocating the single descriptor set.
+	 */
+	class uniform_ring
+	{
+	public:
+		uniform_ring(std::shared_ptr<gfx::device> device, uint32_t frames_in_flight, vk::DeviceSize frame_capacity = UNIFORM_RING_FRAME_SIZE)
+			: device { device }
+		{
+			this->alignment = device->get_physical_device().getProperties().limits.minUniformBufferOffsetAlignment;
+			this->frame_capacity = align(frame_capacity);
+
+			vk::BufferCreateInfo buffer_info({}, this->frame_capacity * frames_in_flight, vk::BufferUsageFlagBits::eUniformBuffer, vk::SharingMode::eExclusive);
+			VkBufferCreateInfo ring_info = static_cast<VkBufferCreateInfo>(buffer_info);
+
+			VmaAllocationCreateInfo alloc_info = {};
+			alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+			alloc_info.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+			VkBuffer ring_buffer;
+			VmaAllocationInfo allocation_info;
+
+			if (vmaCreateBuffer(device->get_vma_allocator(), &ring_info, &alloc_info, &ring_buffer, &allocation, &allocation_info) != VK_SUCCESS)
+			{
+				throw std::runtime_error("unable to allocate uniform ring!");
+			}
+
+			this->buffer = ring_buffer;
+			this->mapped = static_cast<std::byte *>(allocation_info.pMappedData);
+		}
+
+		~uniform_ring()
+		{
+			vmaDestroyBuffer(device->get_vma_allocator(), buffer, allocation);
+		}
+
+		// Starts handing out memory from the region of [frame]. The caller has to make sure the GPU is done with that frame.
+		void begin_frame(uint32_t frame)
+		{
+			this->frame = frame;
+			this->head = 0;
+		}
+
+		// Reserves [size] bytes in the current frame, and returns the dynamic offset to bind them with.
+		uint32_t allocate(vk::DeviceSize size, void **data)
+		{
+			vk::DeviceSize aligned_size = align(size);
+
+			if (head + aligned_size > frame_capacity)
+			{
+				throw std::runtime_error("uniform ring ran out of space for this frame!");
+			}
+
+			vk::DeviceSize offset = frame * frame_capacity + head;
+			this->head += aligned_size;
+
+			*data = mapped + offset;
+			return static_cast<uint32_t>(offset);
+		}
+
+		template<class T>
+		uint32_t push(const T &data)
+		{
+			void *target;
+			uint32_t offset = allocate(sizeof(T), &target);
+
+			memcpy(target, &data, sizeof(T));
+
+			// this is a no-op if the memory happens to be host coherent.
+			vmaFlushAllocation(device->get_vma_allocator(), allocation, offset, sizeof(T));
+
+			return offset;
+		}
+
+		// Points [binding] of [set] at the ring. [range] is the size of the structure a single dynamic offset refers to.
+		void write_descriptor(vk::DescriptorSet set, uint32_t binding, vk::DeviceSize range)
+		{
+			vk::DescriptorBufferInfo buffer_info { buffer, 0, range };
+			vk::WriteDescriptorSet write_descriptor_set {
+				set,
+				binding,
+				0,
+				1,
+				vk::DescriptorType::eUniformBufferDynamic,
+				nullptr,
+				&buffer_info
+			};
+
+			device->get_logical_device().updateDescriptorSets(1, &write_descriptor_set, 0, nullptr);
+		}
+
+		vk::Buffer get_buffer() const
+		{
+			return buffer;
+		}
+
+	private:
+		vk::DeviceSize align(vk::DeviceSize size) const
+		{
+			return (size + alignment - 1) & ~(alignment - 1);
+		}
+
+		std::shared_ptr<gfx::device> device;
+
+		vk::Buffer buffer;
+		VmaAllocation allocation;
+		std::byte *mapped;
+
+		vk::DeviceSize alignment;
+		vk::DeviceSize frame_capacity;
+
+		uint32_t frame = 0;
+		vk::DeviceSize head = 0;
+	};
+}
@@ -0,0 +1,19 @@
+#version 450
+
+layout(binding = 0) uniform sampler2D image;
+
+layout(location = 0) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+
+// shows the depth buffer, linearized with the near and far planes of the camera. the projection is glm's default one,
+// which maps depth to [-1, 1] instead of [0, 1].
+void main() {
+    const float near = 0.1;
+    const float far = 10.0;
+
+    float depth = texture(image, fragUV).r;
+    float linear = 2.0 * near * far / (far + near - depth * (far - near));
+
+    outColor = vec4(vec3(1.0 - linear / far), 1.0);
+}
@@ -0,0 +1,9 @@
+#version 450
+
+layout(location = 0) out vec2 fragUV;
+
+// a single counter-clockwise triangle covering the whole viewport, without any vertex buffer.
+void main() {
+    fragUV = vec2(gl_VertexIndex & 2, (gl_VertexIndex << 1) & 2);
+    gl_Position = vec4(fragUV * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 450
+
+layout(binding = 0) uniform sampler2D image;
+
+layout(location = 0) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec2 offset = fragUV - 0.5;
+    float falloff = smoothstep(0.8, 0.3, length(offset));
+
+    outColor = vec4(texture(image, fragUV).rgb * falloff, 1.0);
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <buffer/arena.h>
+#include <buffer/staging.h>
+#include <debug/zones.h>
+#include <device.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace gfx
+{
+	geometry_arena::geometry_arena(std::shared_ptr<gfx::device> device,
+		std::shared_ptr<gfx::commands> commands,
+		uint32_t vertex_stride,
+		vk::DeviceSize page_size,
+		std::shared_ptr<gfx::uploader> uploader)
+		: device { device }
+		, commands { commands }
+		, uploader { uploader }
+		, vertex_stride { vertex_stride }
+		, page_size { page_size }
+	{
+	}
+
+	geometry_arena::~geometry_arena()
+	{
+		spdlog::info("cleaning up gfx::geometry_arena");
+
+		// deferred frees point into our virtual blocks, so they have to run before the blocks are destroyed.
+		device->get_logical_device().waitIdle();
+		commands->deletion_queue->flush();
+
+		for (auto &page : vertex_pages)
+		{
+			destroy_page(page);
+		}
+
+		for (auto &page : index_pages)
+		{
+			destroy_page(page);
+		}
+
+		spdlog::info("... done!");
+	}
+
+	geometry_arena::page geometry_arena::create_page(vk::BufferUsageFlags usage, vk::DeviceSize size)
+	{
+		page result;
+
+		vk::BufferCreateInfo buffer_info({}, size, usage | vk::BufferUsageFlagBits::eTransferDst, vk::SharingMode::eExclusive);
+		VkBufferCreateInfo page_info = static_cast<VkBufferCreateInfo>(buffer_info);
+		VmaAllocationCreateInfo alloc_info = { 0, VMA_MEMORY_USAGE_GPU_ONLY };
+
+		VkBuffer buffer;
+		VmaAllocationInfo allocation_info;
+
+		VmaAllocationCreateInfo direct_info = {};
+		direct_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+		direct_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		direct_info.memoryTypeBits = device->get_direct_write_memory_types();
+
+		if (device->supports_direct_write()
+			&& vmaCreateBuffer(device->get_vma_allocator(), &page_info, &direct_info, &buffer, &result.allocation, &allocation_info) == VK_SUCCESS)
+		{
+			VkMemoryPropertyFlags memory_flags;
+			vmaGetAllocationMemoryProperties(device->get_vma_allocator(), result.allocation, &memory_flags);
+
+			result.mapped = static_cast<std::byte *>(allocation_info.pMappedData);
+			result.coherent = memory_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		}
+		else if (vmaCreateBuffer(device->get_vma_allocator(), &page_info, &alloc_info, &buffer, &result.allocation, nullptr) != VK_SUCCESS)
+		{
+			throw std::runtime_error("unable to allocate geometry arena page!");
+		}
+
+		// pages aren't tracked by the defragmenter, as every mesh allocated from them holds on to the page's handle.
+		result.buffer = buffer;
+
+		VmaVirtualBlockCreateInfo block_info = {};
+		block_info.size = size;
+
+		if (vmaCreateVirtualBlock(&block_info, &result.block) != VK_SUCCESS)
+		{
+			throw std::runtime_error("unable to create virtual block for geometry arena page!");
+		}
+
+		spdlog::info("created geometry arena page of {} bytes", size);
+		return result;
+	}
+
+	void geometry_arena::destroy_page(page &target)
+	{
+		vmaClearVirtualBlock(target.block);
+		vmaDestroyVirtualBlock(target.block);
+		vmaDestroyBuffer(device->get_vma_allocator(), target.buffer, target.allocation);
+	}
+
+	gfx::arena_slice geometry_arena::allocate(std::vector<page> &pages, vk::BufferUsageFlags usage, vk::DeviceSize size, vk::DeviceSize alignment)
+	{
+		VmaVirtualAllocationCreateInfo info = {};
+
+		// virtual blocks only support power of two alignments, anything else (like a vertex stride) is handled by padding.
+		bool power_of_two = (alignment & (alignment - 1)) == 0;
+
+		info.size = power_of_two ? size : size + alignment - 1;
+		info.alignment = power_of_two ? alignment : 1;
+
+		for (uint32_t i = 0; i <= pages.size(); i++)
+		{
+			if (i == pages.size())
+			{
+				pages.push_back(create_page(usage, std::max(page_size, info.size)));
+			}
+
+			VmaVirtualAllocation allocation;
+			VkDeviceSize offset;
+
+			if (vmaVirtualAllocate(pages[i].block, &info, &allocation, &offset) != VK_SUCCESS)
+			{
+				continue;
+			}
+
+			return gfx::arena_slice {
+				pages[i].buffer,
+				(offset + alignment - 1) / alignment * alignment,
+				size,
+				i,
+				allocation,
+			};
+		}
+
+		throw std::runtime_error("unable to allocate from geometry arena!");
+	}
+
+	gfx::arena_slice geometry_arena::allocate_vertices(vk::DeviceSize size)
+	{
+		return allocate(vertex_pages, vk::BufferUsageFlagBits::eVertexBuffer, size, vertex_stride);
+	}
+
+	gfx::arena_slice geometry_arena::allocate_indices(vk::DeviceSize size, vk::IndexType type)
+	{
+		return allocate(index_pages, vk::BufferUsageFlagBits::eIndexBuffer, size, type == vk::IndexType::eUint16 ? 2 : 4);
+	}
+
+	geometry_arena::page &geometry_arena::find_page(const gfx::arena_slice &slice)
+	{
+		bool is_vertex = slice.page < vertex_pages.size() && vertex_pages[slice.page].buffer == slice.buffer;
+		auto &pages = is_vertex ? vertex_pages : index_pages;
+
+		return pages[slice.page];
+	}
+
+	void geometry_arena::free(const gfx::arena_slice &slice)
+	{
+		VmaVirtualBlock block = find_page(slice).block;
+		VmaVirtualAllocation allocation = slice.allocation;
+
+		// frames in flight may still be drawing from this range, it can only be handed out again once they're done.
+		commands->deletion_queue->push([=]() { vmaVirtualFree(block, allocation); });
+	}
+
+	void geometry_arena::upload(const gfx::arena_slice &slice, const void *data)
+	{
+		VX_ZONE("geometry_arena::upload");
+
+		page &target = find_page(slice);
+
+		if (target.mapped != nullptr)
+		{
+			memcpy(target.mapped + slice.offset, data, slice.size);
+
+			if (!target.coherent)
+			{
+				vmaFlushAllocation(device->get_vma_allocator(), target.allocation, slice.offset, slice.size);
+			}
+
+			return;
+		}
+
+		if (uploader != nullptr)
+		{
+			uploader->upload(slice.buffer, slice.offset, data, slice.size);
+			return;
+		}
+
+		gfx::staging_ring *ring = device->get_staging_ring();
+		gfx::staging_region region = ring->allocate(slice.size);
+
+		memcpy(region.data, data, slice.size);
+
+		vk::CommandBuffer command_buffer = commands->start_small_buffer();
+
+		vk::BufferCopy copy_region(region.offset, slice.offset, slice.size);
+		command_buffer.copyBuffer(region.buffer, slice.buffer, 1, &copy_region);
+
+		// the copy has finished by the time this returns, so the region can be recycled right away.
+		ring->commit(commands->submit_and_wait(command_buffer));
+	}
+
+	gfx::mesh_range geometry_arena::create_mesh(const void *vertices, size_t vertex_count, const void *indices, size_t index_count, vk::IndexType index_type)
+	{
+		vk::DeviceSize index_size = index_type == vk::IndexType::eUint16 ? 2 : 4;
+
+		gfx::mesh_range mesh {
+			allocate_vertices(vertex_count * vertex_stride),
+			allocate_indices(index_count * index_size, index_type),
+			vertex_stride,
+			static_cast<uint32_t>(index_count),
+			index_type,
+		};
+
+		upload(mesh.vertices, vertices);
+		upload(mesh.indices, indices);
+
+		return mesh;
+	}
+}
@@ -1,6 +1,8 @@
 #include "config.h"
 #include <algorithm>
 #include <buffer/buffer.h>
+#include <buffer/staging.h>
+#include <debug/zones.h>
 #include <device.h>
 #include <stdexcept>
 #include <type_traits>
@@ -10,83 +12,69 @@
 namespace gfx
 {
 	template<class T>
-	buffer<T>::buffer(std::shared_ptr<gfx::device> device, std::shared_ptr<gfx::commands> commands, const T &data, size_t size, vk::BufferUsageFlags usage, vma::memory_usage memory_usage)
+	buffer<T>::buffer(std::shared_ptr<gfx::device> device, std::shared_ptr<gfx::commands> commands, const T &data, size_t size, vk::BufferUsageFlags usage, vma::memory_usage memory_usage, std::shared_ptr<gfx::uploader> uploader)
 		: device(device)
 		, commands(commands)
 		, size(size)
 	{
-		if (usage & vk::BufferUsageFlagBits::eTransferDst)
+		VX_ZONE("buffer::buffer");
+
+		if (usage & vk::BufferUsageFlagBits::eTransferDst && device->supports_direct_write() && create_direct_buffer(usage, data))
 		{
-			create_staging_buffer(data, size);
-			create_device_buffer(usage | vk::BufferUsageFlagBits::eTransferDst, memory_usage);
-			copy_data(commands->start_small_buffer());
+			spdlog::debug("wrote {} bytes directly into device-local memory", size);
+		}
+		else if (usage & vk::BufferUsageFlagBits::eTransferDst && uploader != nullptr)
+		{
+			create_device_buffer(usage, memory_usage);
+			gfx::timeline_point upload = uploader->upload(buffers[0], 0, data_pointer(data), size);
+
+			// the transfer queue writes to (and owns) the buffer until a frame has waited on the upload's token.
+			device->get_defragmenter()->hold(allocations[0], upload);
+		}
+		else if (usage & vk::BufferUsageFlagBits::eTransferDst)
+		{
+			create_device_buffer(usage, memory_usage);
+			copy_data(commands->start_small_buffer(), data);
 		}
 		else
 		{
-			for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+			for (size_t i = 0; i < commands->get_frames_in_flight(); i++)
 			{
 				create_device_buffer(usage, memory_usage);
 				void *mapped_data;
 				vmaMapMemory(device->get_vma_allocator(), allocations[i], &mapped_data);
-
-				if constexpr (std::is_const_v<T> && std::is_pointer_v<T>)
-				{
-					memcpy(mapped_data, static_cast<const void *>(data), size);
-				}
-				else
-				{
-					memcpy(mapped_data, reinterpret_cast<const void *>(&data), size);
-				}
+				memcpy(mapped_data, data_pointer(data), size);
 
 				data_mapped.push_back(mapped_data);
-				spdlog::info("buffers: MFIF={}, buffers.size()={}, index={}, T={}", MAX_FRAMES_IN_FLIGHT, buffers.size(), i, typeid(T).name());
+				spdlog::info("buffers: MFIF={}, buffers.size()={}, index={}, T={}", commands->get_frames_in_flight(), buffers.size(), i, typeid(T).name());
 			}
 		}
 	}
 
 	template<class T>
-	void buffer<T>::create_staging_buffer(const T &data, size_t size)
+	const void *buffer<T>::data_pointer(const T &data)
 	{
-		VkBuffer staging_buffer;
-		VmaAllocation staging_allocation;
-
-		// Create the staging buffer.
+		if constexpr (std::is_pointer_v<T>)
 		{
-			vk::BufferCreateInfo staging_buffer_info({}, size, vk::BufferUsageFlagBits::eTransferSrc);
-			VmaAllocationCreateInfo staging_alloc_info = { 0, VMA_MEMORY_USAGE_CPU_ONLY };
-
-			VkBufferCreateInfo staging_info = static_cast<VkBufferCreateInfo>(staging_buffer_info);
-
-			vmaCreateBuffer(device->get_vma_allocator(),
-				&staging_info,
-				&staging_alloc_info,
-				&staging_buffer,
-				&staging_allocation,
-				nullptr);
-
-			void *staging_data;
-			vmaMapMemory(device->get_vma_allocator(), staging_allocation, &staging_data);
-
-			if constexpr (std::is_const_v<T> || std::is_pointer_v<T>)
-			{
-				memcpy(staging_data, static_cast<const void *>(data), size);
-			}
-			else
-			{
-				memcpy(staging_data, reinterpret_cast<const void *>(&data), size);
-			}
-
-			vmaUnmapMemory(device->get_vma_allocator(), staging_allocation);
+			return static_cast<const void *>(data);
+		}
+		else
+		{
+			return reinterpret_cast<const void *>(&data);
 		}
-
-		buffers.push_back(staging_buffer);
 	}
 
 	template<class T>
 	void buffer<T>::create_device_buffer(vk::BufferUsageFlags usage, vma::memory_usage memory_usage)
 	{
-		vk::BufferCreateInfo device_buffer_info({}, size, usage, vk::SharingMode::eExclusive);
-		VmaAllocationCreateInfo device_alloc_info = { 0, vma::to_vma_memory_usage(memory_usage), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT };
+		// buffers that are uploaded to don't need to be host-visible, that's the point of uploading them.
+		VkMemoryPropertyFlags required_flags = usage & vk::BufferUsageFlagBits::eTransferDst ? 0 : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+		// the defragmenter moves a buffer by copying out of it.
+		vk::BufferUsageFlags buffer_usage = usage & vk::BufferUsageFlagBits::eTransferDst ? usage | vk::BufferUsageFlagBits::eTransferSrc : usage;
+
+		vk::BufferCreateInfo device_buffer_info({}, size, buffer_usage, vk::SharingMode::eExclusive);
+		VmaAllocationCreateInfo device_alloc_info = { 0, vma::to_vma_memory_usage(memory_usage), required_flags };
 		VmaAllocation allocation;
 		VkBuffer buffer;
 
@@ -101,25 +89,250 @@ namespace gfx
 
 		buffers.push_back(buffer);
 		allocations.push_back(allocation);
+
+		// device-local buffers are never mapped, so they can safely be moved around by the defragmenter.
+		if (usage & vk::BufferUsageFlagBits::eTransferDst)
+		{
+			size_t index = buffers.size() - 1;
+
+			// buffers can't be copied or moved, so [this] stays valid for as long as the allocation is tracked.
+			device->get_defragmenter()->track(allocation, buffer, device_buffer_info, [this, index](vk::Buffer moved) {
+				this->buffers[index] = moved;
+			});
+		}
+	}
+
+	template<class T>
+	bool buffer<T>::create_direct_buffer(vk::BufferUsageFlags usage, const T &data)
+	{
+		vk::BufferCreateInfo device_buffer_info({}, size, usage, vk::SharingMode::eExclusive);
+		VkBufferCreateInfo device_info = static_cast<VkBufferCreateInfo>(device_buffer_info);
+
+		VmaAllocationCreateInfo device_alloc_info = {};
+		device_alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+		device_alloc_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		device_alloc_info.memoryTypeBits = device->get_direct_write_memory_types();
+
+		VmaAllocation allocation;
+		VmaAllocationInfo allocation_info;
+		VkBuffer buffer;
+
+		if (vmaCreateBuffer(device->get_vma_allocator(), &device_info, &device_alloc_info, &buffer, &allocation, &allocation_info) != VK_SUCCESS)
+		{
+			return false;
+		}
+
+		memcpy(allocation_info.pMappedData, data_pointer(data), size);
+
+		VkMemoryPropertyFlags memory_flags;
+		vmaGetAllocationMemoryProperties(device->get_vma_allocator(), allocation, &memory_flags);
+
+		// writes to coherent memory are visible to the device as soon as the queue submission happens.
+		if (!(memory_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			vmaFlushAllocation(device->get_vma_allocator(), allocation, 0, size);
+		}
+
+		// the buffer stays persistently mapped, so it must never be moved by the defragmenter. it's not exposed through
+		// [data_mapped] though: there's a single copy that frames in flight read from, so later updates are staged and
+		// copied with barriers like any other device-local buffer.
+		buffers.push_back(buffer);
+		allocations.push_back(allocation);
+
+		return true;
 	}
 
 	template<class T>
-	void buffer<T>::copy_data(vk::CommandBuffer command_buffer)
+	void buffer<T>::copy_data(vk::CommandBuffer command_buffer, const T &data)
 	{
-		commands->begin(command_buffer);
-		vk::BufferCopy copy_region(0, 0, size);
-		command_buffer.copyBuffer(buffers[0], buffers[1], 1, &copy_region);
-		commands->submit_and_wait(command_buffer);
+		// the staging ring is persistently mapped, so staging the data is just a memcpy into it.
+		gfx::staging_ring *ring = device->get_staging_ring();
+		gfx::staging_region region = ring->allocate(size);
+
+		memcpy(region.data, data_pointer(data), size);
 
-		std::swap(buffers[0], buffers[1]);
+		vk::BufferCopy copy_region(region.offset, 0, size);
+		command_buffer.copyBuffer(region.buffer, buffers[0], 1, &copy_region);
+
+		// the copy has finished by the time this returns, so the region can be recycled right away.
+		ring->commit(commands->submit_and_wait(command_buffer));
+	}
+
+	template<class T>
+	void buffer<T>::update(vk::DeviceSize offset, std::span<const std::byte> bytes, int frame)
+	{
+		VX_ZONE("buffer::update");
+
+		if (offset + bytes.size() > size)
+		{
+			throw std::runtime_error("tried updating bytes outside of the buffer!");
+		}
+
+		if (!data_mapped.empty())
+		{
+			if (frame < 0 || static_cast<size_t>(frame) >= data_mapped.size())
+			{
+				throw std::runtime_error("tried updating a frame the buffer doesn't have a copy for!");
+			}
+
+			memcpy(static_cast<std::byte *>(data_mapped[frame]) + offset, bytes.data(), bytes.size());
+
+			dirty_ranges.resize(data_mapped.size());
+			dirty_ranges[frame].emplace_back(offset, bytes.size());
+			return;
+		}
+
+		vk::DeviceSize begin = offset;
+		vk::DeviceSize end = offset + bytes.size();
+
+		// find the first pending range that overlaps or touches the new one.
+		auto first = pending.upper_bound(begin);
+
+		if (first != pending.begin() && std::prev(first)->first + std::prev(first)->second.size() >= begin)
+		{
+			first--;
+		}
+
+		auto last = first;
+
+		vk::DeviceSize merged_begin = begin;
+		vk::DeviceSize merged_end = end;
+
+		while (last != pending.end() && last->first <= end)
+		{
+			merged_begin = std::min(merged_begin, last->first);
+			merged_end = std::max(merged_end, last->first + last->second.size());
+			last++;
+		}
+
+		std::vector<std::byte> merged(merged_end - merged_begin);
+
+		for (auto it = first; it != last; it++)
+		{
+			memcpy(merged.data() + (it->first - merged_begin), it->second.data(), it->second.size());
+		}
+
+		memcpy(merged.data() + (begin - merged_begin), bytes.data(), bytes.size());
+
+		pending.erase(first, last);
+		pending.emplace(merged_begin, std::move(merged));
+	}
+
+	template<class T>
+	void buffer<T>::flush(vk::CommandBuffer command_buffer, int frame)
+	{
+		VX_ZONE("buffer::flush");
+
+		if (!data_mapped.empty())
+		{
+			if (static_cast<size_t>(frame) >= dirty_ranges.size() || dirty_ranges[frame].empty())
+			{
+				return;
+			}
+
+			auto &ranges = dirty_ranges[frame];
+			std::sort(ranges.begin(), ranges.end());
+
+			std::vector<VmaAllocation> flush_allocations;
+			std::vector<VkDeviceSize> flush_offsets;
+			std::vector<VkDeviceSize> flush_sizes;
+
+			for (const auto &[offset, range_size] : ranges)
+			{
+				// merge with the previous range if they overlap or touch.
+				if (!flush_offsets.empty() && flush_offsets.back() + flush_sizes.back() >= offset)
+				{
+					flush_sizes.back() = std::max(flush_offsets.back() + flush_sizes.back(), offset + range_size) - flush_offsets.back();
+					continue;
+				}
+
+				flush_allocations.push_back(allocations[frame]);
+				flush_offsets.push_back(offset);
+				flush_sizes.push_back(range_size);
+			}
+
+			// this is a no-op for host coherent memory.
+			vmaFlushAllocations(device->get_vma_allocator(),
+				static_cast<uint32_t>(flush_allocations.size()),
+				flush_allocations.data(),
+				flush_offsets.data(),
+				flush_sizes.data());
+
+			ranges.clear();
+			return;
+		}
+
+		if (pending.empty())
+		{
+			return;
+		}
+
+		vk::DeviceSize total = 0;
+
+		for (const auto &[offset, bytes] : pending)
+		{
+			total += bytes.size();
+		}
+
+		gfx::staging_ring *ring = device->get_staging_ring();
+		gfx::staging_region region = ring->allocate(total);
+
+		std::vector<vk::BufferCopy> copy_regions;
+		vk::DeviceSize staged = 0;
+
+		for (const auto &[offset, bytes] : pending)
+		{
+			memcpy(static_cast<std::byte *>(region.data) + staged, bytes.data(), bytes.size());
+			copy_regions.push_back(vk::BufferCopy(region.offset + staged, offset, bytes.size()));
+
+			staged += bytes.size();
+		}
+
+		// earlier frames may still be reading the buffer, don't overwrite it before they're done.
+		command_buffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader,
+			vk::PipelineStageFlagBits::eTransfer,
+			{},
+			nullptr,
+			nullptr,
+			nullptr);
+
+		command_buffer.copyBuffer(region.buffer, buffers[0], copy_regions);
+
+		vk::BufferMemoryBarrier barrier {
+			vk::AccessFlagBits::eTransferWrite,
+			vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eUniformRead,
+			VK_QUEUE_FAMILY_IGNORED,
+			VK_QUEUE_FAMILY_IGNORED,
+			buffers[0],
+			0,
+			VK_WHOLE_SIZE,
+		};
+
+		command_buffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader,
+			{},
+			nullptr,
+			barrier,
+			nullptr);
+
+		// the frame is still being recorded, the regions can only be waited on once [draw] has submitted it.
+		ring->commit_unsubmitted(commands->get_frame_point());
+		pending.clear();
 	}
 
 	template<class T>
 	void buffer<T>::destroy()
 	{
-		for (int i = 0; i < buffers.size(); i++)
+		for (size_t i = 0; i < buffers.size(); i++)
 		{
-			vmaDestroyBuffer(device->get_vma_allocator(), buffers[i], allocations[i]);
+			// if the buffer is in the middle of being moved, the defragmenter will take care of destroying it.
+			if (device->get_defragmenter()->untrack(allocations[i]))
+			{
+				// frames in flight may still be reading the buffer, so it's only destroyed once they're done.
+				commands->deletion_queue->destroy(buffers[i], allocations[i]);
+			}
 		}
 	}
 
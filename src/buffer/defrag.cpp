@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <buffer/defrag.h>
+#include <device.h>
+#include <spdlog/spdlog.h>
+
+namespace gfx
+{
+	defragmenter::defragmenter(gfx::device *device)
+		: device { device }
+	{
+		// reserved up front as well, so the first defragmentation doesn't allocate in the middle of the render loop.
+		this->pass_moves.reserve(max_moves_per_pass);
+		this->retired.reserve(max_moves_per_pass * 2);
+	}
+
+	defragmenter::~defragmenter()
+	{
+		if (pass_pending)
+		{
+			device->get_logical_device().waitIdle();
+			this->end_pass();
+		}
+
+		if (context != nullptr)
+		{
+			this->finish();
+		}
+	}
+
+	void defragmenter::track(VmaAllocation allocation, vk::Buffer buffer, const vk::BufferCreateInfo &info, std::function<void(vk::Buffer)> on_moved)
+	{
+		tracked.insert_or_assign(allocation, tracked_buffer { buffer, info, std::move(on_moved), std::nullopt });
+	}
+
+	void defragmenter::hold(VmaAllocation allocation, gfx::timeline_point upload)
+	{
+		auto it = tracked.find(allocation);
+
+		if (it != tracked.end())
+		{
+			it->second.upload = upload;
+		}
+	}
+
+	void defragmenter::release(gfx::timeline_point upload)
+	{
+		for (auto &[allocation, target] : tracked)
+		{
+			// a frame waiting on a value of a timeline has waited on every earlier one too.
+			if (target.upload.has_value() && target.upload->semaphore == upload.semaphore && target.upload->value <= upload.value)
+			{
+				target.upload.reset();
+			}
+		}
+	}
+
+	bool defragmenter::untrack(VmaAllocation allocation)
+	{
+		auto it = tracked.find(allocation);
+
+		if (it == tracked.end())
+		{
+			return true;
+		}
+
+		auto move = std::find_if(pass_moves.begin(), pass_moves.end(), [&](const auto &move) { return move.first == allocation; });
+
+		if (pass_pending && move != pass_moves.end())
+		{
+			// VMA frees the allocation for us when the pass ends, we only have to get rid of the new buffer.
+			pass.pMoves[move->second].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_DESTROY;
+			retired.push_back(it->second.buffer);
+
+			*move = pass_moves.back();
+			pass_moves.pop_back();
+			tracked.erase(it);
+
+			return false;
+		}
+
+		tracked.erase(it);
+		return true;
+	}
+
+	void defragmenter::start()
+	{
+		if (context != nullptr)
+		{
+			return;
+		}
+
+		// a pass moves at most [max_moves_per_pass] allocations, so recording one never has to grow these. every move
+		// retires a buffer, and so may an [untrack] of an allocation that's being moved.
+		this->pass_moves.reserve(max_moves_per_pass);
+		this->retired.reserve(max_moves_per_pass * 2);
+
+		VmaDefragmentationInfo info = {};
+		info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+		info.maxBytesPerPass = max_bytes_per_pass;
+		info.maxAllocationsPerPass = max_moves_per_pass;
+
+		if (vmaBeginDefragmentation(device->get_vma_allocator(), &info, &context) != VK_SUCCESS)
+		{
+			spdlog::warn("unable to begin defragmentation");
+			context = nullptr;
+		}
+	}
+
+	void defragmenter::step(vk::CommandBuffer command_buffer, uint32_t frame)
+	{
+		if (context == nullptr)
+		{
+			if (enabled && ++idle_frames >= interval)
+			{
+				idle_frames = 0;
+				this->start();
+			}
+
+			return;
+		}
+
+		if (pass_pending)
+		{
+			// the copies were recorded into this frame slot, which has been waited on by now if we see it again.
+			if (frame != pass_frame)
+			{
+				return;
+			}
+
+			this->end_pass();
+
+			if (context == nullptr)
+			{
+				return;
+			}
+		}
+
+		this->begin_pass(command_buffer, frame);
+	}
+
+	void defragmenter::begin_pass(vk::CommandBuffer command_buffer, uint32_t frame)
+	{
+		VmaAllocator allocator = device->get_vma_allocator();
+
+		if (vmaBeginDefragmentationPass(allocator, context, &pass) == VK_SUCCESS)
+		{
+			// nothing left to move.
+			this->finish();
+			return;
+		}
+
+		// copies submitted earlier on this queue (staged updates, a previous pass) have to finish writing before we copy
+		// out of, or over, the memory they wrote.
+		vk::MemoryBarrier before {
+			vk::AccessFlagBits::eTransferWrite,
+			vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite,
+		};
+
+		command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, before, nullptr, nullptr);
+
+		for (uint32_t i = 0; i < pass.moveCount; i++)
+		{
+			VmaDefragmentationMove &move = pass.pMoves[i];
+			auto it = tracked.find(move.srcAllocation);
+
+			// we don't know who else holds on to this allocation (or its mapped pointer), so we can't move it.
+			if (it == tracked.end())
+			{
+				move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+				continue;
+			}
+
+			tracked_buffer &target = it->second;
+
+			// the upload may still be writing to the buffer, and a copy can't read it before it has been acquired.
+			if (target.upload.has_value() || !(target.info.usage & vk::BufferUsageFlagBits::eTransferSrc))
+			{
+				move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+				continue;
+			}
+
+			vk::Buffer moved = device->get_logical_device().createBuffer(target.info);
+
+			if (vmaBindBufferMemory(allocator, move.dstTmpAllocation, moved) != VK_SUCCESS)
+			{
+				device->get_logical_device().destroyBuffer(moved);
+				move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+				continue;
+			}
+
+			vk::BufferCopy copy_region(0, 0, target.info.size);
+			command_buffer.copyBuffer(target.buffer, moved, 1, &copy_region);
+
+			// everything recorded after this point uses the new buffer, the old one lives until the pass has ended.
+			retired.push_back(target.buffer);
+
+			target.buffer = moved;
+			target.on_moved(moved);
+
+			pass_moves.emplace_back(move.srcAllocation, i);
+		}
+
+		// the moved buffers may be drawn from, or updated with another copy, later in the frame.
+		vk::MemoryBarrier after {
+			vk::AccessFlagBits::eTransferWrite,
+			vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eUniformRead
+				| vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite,
+		};
+
+		command_buffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eTransfer,
+			{},
+			after,
+			nullptr,
+			nullptr);
+
+		spdlog::debug("defragmentation pass recorded {} moves", pass_moves.size());
+
+		this->pass_pending = true;
+		this->pass_frame = frame;
+	}
+
+	void defragmenter::end_pass()
+	{
+		for (auto buffer : retired)
+		{
+			device->get_logical_device().destroyBuffer(buffer);
+		}
+
+		retired.clear();
+		pass_moves.clear();
+		pass_pending = false;
+
+		if (vmaEndDefragmentationPass(device->get_vma_allocator(), context, &pass) == VK_SUCCESS)
+		{
+			this->finish();
+		}
+	}
+
+	void defragmenter::finish()
+	{
+		VmaDefragmentationStats stats;
+		vmaEndDefragmentation(device->get_vma_allocator(), context, &stats);
+
+		context = nullptr;
+
+		spdlog::info("defragmentation finished, moved {} allocations ({} bytes), freed {} bytes",
+			stats.allocationsMoved,
+			stats.bytesMoved,
+			stats.bytesFreed);
+	}
+}
@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <buffer/staging.h>
+#include <device.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace gfx
+{
+	staging_ring::staging_ring(gfx::device *device, vk::DeviceSize capacity)
+		: device { device }
+		, capacity { capacity }
+	{
+		vk::BufferCreateInfo buffer_info({}, capacity, vk::BufferUsageFlagBits::eTransferSrc, vk::SharingMode::eExclusive);
+		VkBufferCreateInfo staging_info = static_cast<VkBufferCreateInfo>(buffer_info);
+
+		VmaAllocationCreateInfo alloc_info = {};
+		alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+		alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+		VkBuffer staging_buffer;
+		VmaAllocationInfo allocation_info;
+
+		if (vmaCreateBuffer(device->get_vma_allocator(), &staging_info, &alloc_info, &staging_buffer, &allocation, &allocation_info) != VK_SUCCESS)
+		{
+			throw std::runtime_error("unable to allocate staging ring!");
+		}
+
+		this->buffer = staging_buffer;
+		this->mapped = static_cast<std::byte *>(allocation_info.pMappedData);
+
+		spdlog::info("created staging ring with a capacity of {} bytes", capacity);
+	}
+
+	staging_ring::~staging_ring()
+	{
+		// the pending regions may belong to timelines that are already gone, so wait for the device as a whole.
+		device->get_logical_device().waitIdle();
+
+		vmaDestroyBuffer(device->get_vma_allocator(), buffer, allocation);
+	}
+
+	gfx::staging_region staging_ring::allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+	{
+		if (size > capacity)
+		{
+			throw std::runtime_error("tried allocating more bytes than the staging ring can hold!");
+		}
+
+		vk::DeviceSize offset;
+
+		if (!try_reserve(size, alignment, offset))
+		{
+			this->reclaim();
+
+			// if reclaiming wasn't enough, we have no choice but to wait for the GPU to catch up.
+			while (!try_reserve(size, alignment, offset))
+			{
+				if (pending.empty())
+				{
+					throw std::runtime_error("staging ring is full with uncommitted uploads, commit them before allocating more!");
+				}
+
+				this->wait_oldest();
+			}
+		}
+
+		return gfx::staging_region {
+			this->buffer,
+			offset,
+			size,
+			this->mapped + offset,
+		};
+	}
+
+	void staging_ring::add_submitter(vk::Semaphore timeline, std::function<void()> submit)
+	{
+		submitters.emplace_back(timeline, std::move(submit));
+	}
+
+	void staging_ring::remove_submitter(vk::Semaphore timeline)
+	{
+		std::erase_if(submitters, [&](const auto &submitter) { return submitter.first == timeline; });
+	}
+
+	bool staging_ring::try_reserve(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize &offset)
+	{
+		if (used == 0)
+		{
+			// nothing is in flight, we can start over from the beginning of the ring.
+			head = 0;
+			tail = 0;
+		}
+
+		vk::DeviceSize aligned = (head + alignment - 1) & ~(alignment - 1);
+
+		if (head > tail || used == 0)
+		{
+			// the free space is [head, capacity) followed by [0, tail).
+			if (aligned + size <= capacity)
+			{
+				offset = aligned;
+			}
+			else if (size <= tail)
+			{
+				// wrap around, the remainder of the ring is wasted until the tail passes it.
+				aligned = capacity;
+				offset = 0;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else
+		{
+			// the free space is [head, tail).
+			if (aligned + size > tail)
+			{
+				return false;
+			}
+
+			offset = aligned;
+		}
+
+		vk::DeviceSize consumed = (aligned - head) + size;
+
+		this->head = offset + size;
+		this->used += consumed;
+		this->uncommitted += consumed;
+
+		return true;
+	}
+
+	void staging_ring::commit(gfx::timeline_point point)
+	{
+		if (uncommitted == 0)
+		{
+			return;
+		}
+
+		pending.push_back(pending_region { point, head, uncommitted, true });
+		this->uncommitted = 0;
+	}
+
+	void staging_ring::commit_unsubmitted(gfx::timeline_point point)
+	{
+		if (uncommitted == 0)
+		{
+			return;
+		}
+
+		pending.push_back(pending_region { point, head, uncommitted, false });
+		this->uncommitted = 0;
+	}
+
+	void staging_ring::mark_submitted(gfx::timeline_point point)
+	{
+		for (pending_region &region : pending)
+		{
+			if (region.point.semaphore == point.semaphore && region.point.value <= point.value)
+			{
+				region.submitted = true;
+			}
+		}
+	}
+
+	void staging_ring::reclaim()
+	{
+		while (!pending.empty())
+		{
+			auto &region = pending.front();
+
+			if (!region.point.is_complete(device->get_logical_device()))
+			{
+				break;
+			}
+
+			this->tail = region.end;
+			this->used -= region.bytes;
+
+			pending.pop_front();
+		}
+	}
+
+	void staging_ring::wait_oldest()
+	{
+		auto &region = pending.front();
+
+		if (!region.submitted)
+		{
+			auto submitter = std::find_if(submitters.begin(), submitters.end(), [&](const auto &submitter) {
+				return submitter.first == region.point.semaphore;
+			});
+
+			// this only marks regions as submitted, so [region] stays valid.
+			if (submitter != submitters.end())
+			{
+				submitter->second();
+			}
+		}
+
+		// nothing would ever signal the point, waiting on it would block forever.
+		if (!region.submitted)
+		{
+			throw std::runtime_error("staging ring is full with uploads that haven't been submitted, and nothing registered to submit them!");
+		}
+
+		region.point.wait(device->get_logical_device());
+
+		this->tail = region.end;
+		this->used -= region.bytes;
+
+		pending.pop_front();
+	}
+}
@@ -0,0 +1,177 @@
+#include <buffer/staging.h>
+#include <buffer/upload.h>
+#include <debug/zones.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace gfx
+{
+	uploader::uploader(std::shared_ptr<gfx::device> device)
+		: device { device }
+		, timeline { device->get_logical_device() }
+	{
+		vk::CommandPoolCreateInfo pool_info {
+			vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+			device->get_queue_families().get_transfer_family(),
+		};
+
+		this->command_pool = device->get_logical_device().createCommandPool(pool_info);
+
+		// any allocation from the ring may have to force out our batch, if its uploads are the oldest ones left.
+		device->get_staging_ring()->add_submitter(timeline.get_semaphore(), [this]() {
+			if (recording.has_value())
+			{
+				this->submit_batch();
+			}
+		});
+	}
+
+	uploader::~uploader()
+	{
+		spdlog::info("cleaning up gfx::uploader");
+
+		device->get_staging_ring()->remove_submitter(timeline.get_semaphore());
+
+		// frames may still be waiting on our timeline, which is destroyed along with us.
+		device->get_logical_device().waitIdle();
+		device->get_logical_device().destroyCommandPool(command_pool);
+		spdlog::info("... done!");
+	}
+
+	void uploader::begin_batch()
+	{
+		this->collect();
+
+		if (free_batches.empty())
+		{
+			free_batches.push_back(batch {
+				device->get_logical_device().allocateCommandBuffers(vk::CommandBufferAllocateInfo(command_pool, vk::CommandBufferLevel::ePrimary, 1))[0],
+				0,
+			});
+		}
+
+		this->recording = free_batches.back();
+		free_batches.pop_back();
+
+		recording->value = timeline.next();
+
+		recording->command_buffer.begin(vk::CommandBufferBeginInfo { vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+	}
+
+	gfx::timeline_point uploader::upload(vk::Buffer destination, vk::DeviceSize offset, const void *data, vk::DeviceSize size)
+	{
+		VX_ZONE("uploader::upload");
+
+		gfx::staging_ring *ring = device->get_staging_ring();
+		// if the ring is full with this batch's own uploads, our submitter sends the batch off early and the rest goes into
+		// a new one. the token [flush] hands out covers both, as batches are submitted in the order of their values.
+		gfx::staging_region region = ring->allocate(size);
+
+		if (!recording.has_value())
+		{
+			this->begin_batch();
+		}
+
+		memcpy(region.data, data, size);
+
+		// commit right away, so synchronous uploads in between can't claim this region with their own timeline point.
+		ring->commit_unsubmitted(timeline.point(recording->value));
+
+		vk::BufferCopy copy_region(region.offset, offset, size);
+		recording->command_buffer.copyBuffer(region.buffer, destination, 1, &copy_region);
+
+		gfx::queue_family_indices families = device->get_queue_families();
+		gfx::timeline_point point = timeline.point(recording->value);
+
+		// without a dedicated transfer family, the semaphore wait alone is enough to make the copies visible.
+		if (!device->has_dedicated_transfer())
+		{
+			return point;
+		}
+
+		// the release half of the queue family ownership transfer, the acquire half is recorded by the renderer.
+		vk::BufferMemoryBarrier barrier {
+			vk::AccessFlagBits::eTransferWrite,
+			{},
+			families.transfer_family.value(),
+			families.graphics_family.value(),
+			destination,
+			offset,
+			size,
+		};
+
+		recording->command_buffer.pipelineBarrier(
+			vk::PipelineStageFlagBits::eTransfer,
+			vk::PipelineStageFlagBits::eBottomOfPipe,
+			{},
+			nullptr,
+			barrier,
+			nullptr);
+
+		barrier.srcAccessMask = {};
+		barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead
+			| vk::AccessFlagBits::eVertexAttributeRead
+			| vk::AccessFlagBits::eIndexRead
+			| vk::AccessFlagBits::eUniformRead;
+
+		recording_barriers.push_back(barrier);
+
+		return point;
+	}
+
+	std::optional<gfx::upload_token> uploader::flush()
+	{
+		VX_ZONE("uploader::flush");
+
+		if (recording.has_value())
+		{
+			this->submit_batch();
+		}
+
+		// batches may also have been submitted early by the staging ring, those still need a token.
+		if (!unflushed.has_value())
+		{
+			return std::nullopt;
+		}
+
+		gfx::upload_token token { timeline.point(unflushed.value()), std::move(recording_barriers) };
+		recording_barriers.clear();
+		unflushed.reset();
+
+		return token;
+	}
+
+	void uploader::submit_batch()
+	{
+		recording->command_buffer.end();
+
+		vk::Semaphore semaphore = timeline.get_semaphore();
+		vk::TimelineSemaphoreSubmitInfo timeline_info(0, nullptr, 1, &recording->value);
+
+		vk::SubmitInfo submit_info(0, nullptr, nullptr, 1, &recording->command_buffer, 1, &semaphore, &timeline_info);
+		device->transfer_queue.submit(submit_info);
+
+		device->get_staging_ring()->mark_submitted(timeline.point(recording->value));
+		this->unflushed = recording->value;
+
+		in_flight.push_back(recording.value());
+		recording.reset();
+	}
+
+	void uploader::collect()
+	{
+		for (auto it = in_flight.begin(); it != in_flight.end();)
+		{
+			if (!timeline.is_complete(it->value))
+			{
+				it++;
+				continue;
+			}
+
+			it->command_buffer.reset();
+
+			free_batches.push_back(*it);
+			it = in_flight.erase(it);
+		}
+	}
+}
@@ -1,18 +1,31 @@
 #include "device.h"
+#include <algorithm>
 #include <commands.h>
 #include <config.h>
+#include <debug/zones.h>
 #include <vulkan/vulkan_handles.hpp>
 
 namespace gfx
 {
-	commands::commands(std::shared_ptr<gfx::swapchain> swapchain, vk::SurfaceKHR *surface)
+	commands::commands(std::shared_ptr<gfx::swapchain> swapchain, vk::SurfaceKHR *surface, uint32_t frames_in_flight)
 		: swapchain { swapchain }
 		, device { swapchain->device }
 		, surface { surface }
+		, frames_in_flight { frames_in_flight }
 	{
+		if (frames_in_flight < 1 || frames_in_flight > MAX_FRAMES_IN_FLIGHT)
+		{
+			throw std::runtime_error("frames in flight has to be between 1 and " + std::to_string(MAX_FRAMES_IN_FLIGHT) + "!");
+		}
+
 		this->create_sync_objects();
 		this->create_command_pool();
 		this->initialize_command_buffers();
+
+		this->deletion_queue = std::make_unique<gfx::deletion_queue>(device, frame_timeline.get());
+
+		this->profiler = std::make_unique<gfx::gpu_profiler>(device, frames_in_flight);
+		swapchain->profiler = profiler.get();
 	}
 
 	commands::~commands()
@@ -23,7 +36,33 @@ namespace gfx
 	void commands::cleanup()
 	{
 		spdlog::info("cleaning up gfx::commands");
-		device->get_logical_device().destroyCommandPool(this->command_pool);
+
+		auto logical_device = device->get_logical_device();
+
+		// anything that's still deferred has to go before the device does.
+		logical_device.waitIdle();
+		deletion_queue.reset();
+
+		swapchain->profiler = nullptr;
+		swapchain->statistics = nullptr;
+		profiler.reset();
+		statistics.reset();
+
+		frame_timeline.reset();
+		transient_timeline.reset();
+
+		for (auto semaphore : image_available_semaphores)
+		{
+			logical_device.destroySemaphore(semaphore);
+		}
+
+		for (auto semaphore : render_finished_semaphores)
+		{
+			logical_device.destroySemaphore(semaphore);
+		}
+
+		logical_device.destroyCommandPool(this->transient_pool);
+		logical_device.destroyCommandPool(this->command_pool);
 		spdlog::info("... done!");
 	}
 
@@ -35,6 +74,12 @@ namespace gfx
 		};
 
 		this->command_pool = device->get_logical_device().createCommandPool(pool_info);
+
+		vk::CommandPoolCreateInfo transient_info {
+			vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer, indices.graphics_family.value()
+		};
+
+		this->transient_pool = device->get_logical_device().createCommandPool(transient_info);
 	}
 
 	void commands::initialize_command_buffers()
@@ -43,74 +88,170 @@ namespace gfx
 			vk::CommandBufferAllocateInfo(
 				this->command_pool,
 				vk::CommandBufferLevel::ePrimary,
-				MAX_FRAMES_IN_FLIGHT));
+				frames_in_flight));
 	}
 
 	void commands::create_sync_objects()
 	{
 		vk::SemaphoreCreateInfo semaphore_info;
-		vk::FenceCreateInfo fence_info { vk::FenceCreateFlagBits::eSignaled };
 
-		for (auto i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		for (uint32_t i = 0; i < frames_in_flight; i++)
 		{
 			this->image_available_semaphores.push_back(device->get_logical_device().createSemaphore(semaphore_info));
 			this->render_finished_semaphores.push_back(device->get_logical_device().createSemaphore(semaphore_info));
-			this->in_flight_fences.push_back(device->get_logical_device().createFence(fence_info));
 		}
+
+		// a value of 0 is reached from the start, so every frame slot can be used right away.
+		this->frame_values.resize(frames_in_flight, 0);
+
+		this->frame_timeline = std::make_unique<gfx::timeline>(device->get_logical_device());
+		this->transient_timeline = std::make_unique<gfx::timeline>(device->get_logical_device());
 	}
 
 	vk::CommandBuffer commands::start_small_buffer()
 	{
-		return device->get_logical_device().allocateCommandBuffers(
-			vk::CommandBufferAllocateInfo(
-				this->command_pool,
-				vk::CommandBufferLevel::ePrimary,
-				1))[0];
-	}
+		this->collect_transient();
 
-	void commands::begin(const vk::CommandBuffer &command_buffer)
-	{
-		if (device->get_logical_device().waitForFences(in_flight_fences[current_frame], true, UINT64_MAX) != vk::Result::eSuccess)
+		if (transient_free.empty())
 		{
-			throw std::runtime_error("unable to wait for fence in_flight_fence!");
+			transient_free.push_back(transient_buffer {
+				device->get_logical_device().allocateCommandBuffers(
+					vk::CommandBufferAllocateInfo(
+						this->transient_pool,
+						vk::CommandBufferLevel::ePrimary,
+						1))[0],
+				0,
+			});
 		}
 
-		device->get_logical_device().resetFences(in_flight_fences[current_frame]);
+		transient_buffer transient = transient_free.back();
+		transient_free.pop_back();
 
-		command_buffer.reset(); // reset command buffer
-		command_buffer.begin(vk::CommandBufferBeginInfo {});
+		transient.buffer.begin(vk::CommandBufferBeginInfo { vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+		transient_recording.push_back(transient);
+
+		return transient.buffer;
 	}
 
-	void commands::submit_and_wait(const vk::CommandBuffer &command_buffer)
+	void commands::collect_transient()
 	{
-		command_buffer.end();
+		for (auto it = transient_in_flight.begin(); it != transient_in_flight.end();)
+		{
+			if (!transient_timeline->is_complete(it->value))
+			{
+				it++;
+				continue;
+			}
 
-		vk::Fence *fence = &in_flight_fences[current_frame];
-		vk::SubmitInfo submit_info(0, nullptr, nullptr, 1, &command_buffer, 0, nullptr);
+			it->buffer.reset();
 
-		device->graphics_queue.submit(submit_info, *fence);
+			transient_free.push_back(*it);
+			it = transient_in_flight.erase(it);
+		}
+	}
 
-		vk::Result result = device->get_logical_device().waitForFences(*fence, VK_TRUE, UINT64_MAX);
+	gfx::timeline_point commands::submit_transient(const vk::CommandBuffer &command_buffer)
+	{
+		auto it = std::find_if(transient_recording.begin(), transient_recording.end(), [&](const transient_buffer &transient) {
+			return transient.buffer == command_buffer;
+		});
 
-		if (result != vk::Result::eSuccess)
+		if (it == transient_recording.end())
 		{
-			throw std::runtime_error("Failed to wait for fence");
+			throw std::runtime_error("command buffer wasn't handed out by start_small_buffer()!");
 		}
+
+		command_buffer.end();
+
+		// values are handed out at submission time, so one-shot buffers can be submitted in any order.
+		it->value = transient_timeline->next();
+
+		vk::Semaphore signal_semaphore = transient_timeline->get_semaphore();
+		vk::TimelineSemaphoreSubmitInfo timeline_info(0, nullptr, 1, &it->value);
+
+		vk::SubmitInfo submit_info(0, nullptr, nullptr, 1, &command_buffer, 1, &signal_semaphore, &timeline_info);
+		device->graphics_queue.submit(submit_info);
+
+		gfx::timeline_point point = transient_timeline->point(it->value);
+
+		transient_in_flight.push_back(*it);
+		transient_recording.erase(it);
+
+		return point;
 	}
 
-	void commands::submit_nowait(std::function<void(vk::CommandBuffer &buffer)> callback)
+	void commands::begin(const vk::CommandBuffer &command_buffer)
 	{
-		auto command_buffer = start_small_buffer();
+		VX_ZONE("commands::begin");
+
+		// wait for the last frame that used this slot, which also means every frame before it has finished.
+		frame_timeline->wait(frame_values[current_frame]);
+
+		// everything released while recording the frames that have finished can go now.
+		deletion_queue->collect();
+
+		frame_count = frame_timeline->next();
+		frame_values[current_frame] = frame_count;
+
 		command_buffer.reset(); // reset command buffer
 		command_buffer.begin(vk::CommandBufferBeginInfo {});
 
-		callback(command_buffer);
+		// the last frame in this slot has finished, so its timestamps can be read back without waiting.
+		profiler->begin_frame(command_buffer, current_frame);
 
-		command_buffer.end();
+		if (statistics)
+		{
+			statistics->begin_frame(command_buffer, current_frame);
+		}
+	}
 
-		vk::Fence *fence = &in_flight_fences[current_frame];
-		vk::SubmitInfo submit_info(0, nullptr, nullptr, 1, &command_buffer, 0, nullptr);
+	bool commands::enable_statistics()
+	{
+		if (!device->supports_pipeline_statistics())
+		{
+			spdlog::warn("the device doesn't support pipeline statistics queries");
+			return false;
+		}
+
+		if (!statistics)
+		{
+			this->statistics = std::make_unique<gfx::pipeline_statistics>(device, frames_in_flight);
+			swapchain->statistics = statistics.get();
+		}
+
+		return true;
+	}
+
+	void commands::skip_frame()
+	{
+		gfx::timeline_point point = this->get_frame_point();
+
+		vk::TimelineSemaphoreSubmitInfo timeline_info(0, nullptr, 1, &point.value);
+		vk::SubmitInfo submit_info(0, nullptr, nullptr, 0, nullptr, 1, &point.semaphore, &timeline_info);
+
+		// a host-side signal could overtake frames that are still executing, a submission is ordered after them.
+		device->graphics_queue.submit(submit_info);
+		device->get_staging_ring()->mark_submitted(point);
+	}
+
+	gfx::timeline_point commands::submit_and_wait(const vk::CommandBuffer &command_buffer)
+	{
+		VX_ZONE("commands::submit_and_wait");
+
+		gfx::timeline_point point = this->submit_transient(command_buffer);
+		transient_timeline->wait(point.value);
+
+		return point;
+	}
+
+	gfx::timeline_point commands::submit_nowait(gfx::function_ref<void(vk::CommandBuffer &buffer)> callback)
+	{
+		VX_ZONE("commands::submit_nowait");
+
+		auto command_buffer = start_small_buffer();
+
+		callback(command_buffer);
 
-		device->graphics_queue.submit(submit_info, *fence);
+		return this->submit_transient(command_buffer);
 	}
 }
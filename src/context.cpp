@@ -8,9 +8,15 @@
 
 namespace gfx
 {
-	context::context()
+	context::context(uint32_t frames_in_flight)
+		: frames_in_flight { frames_in_flight }
 	{
-		spdlog::info("initializing gfx::context()");
+		if (frames_in_flight < 1 || frames_in_flight > MAX_FRAMES_IN_FLIGHT)
+		{
+			throw std::runtime_error("frames in flight has to be between 1 and " + std::to_string(MAX_FRAMES_IN_FLIGHT) + "!");
+		}
+
+		spdlog::info("initializing gfx::context() with {} frames in flight", frames_in_flight);
 		this->create_window();
 		this->create_instance();
 		this->create_surface();
@@ -48,7 +54,7 @@ namespace gfx
 		glfwInit(); // initialize GLFW
 
 		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // tell GLFW not to create an OpenGL context
-		glfwWindowHint(GLFW_RESIZABLE, GLFW_NO_API); // make the window non-resizable
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE); // the swapchain is recreated whenever the window is resized
 
 		window = glfwCreateWindow(
 			WIDTH, HEIGHT, // window size
@@ -56,6 +62,17 @@ namespace gfx
 			nullptr, // monitor to use for fullscreen mode
 			nullptr // window to share resources with (none)
 		);
+
+		// not every platform reports a resize through an out-of-date swapchain, so we flag it ourselves.
+		glfwSetWindowUserPointer(window, this);
+		glfwSetFramebufferSizeCallback(window, [](GLFWwindow *window, int width, int height) {
+			auto *context = static_cast<gfx::context *>(glfwGetWindowUserPointer(window));
+
+			if (context->swapchain != nullptr)
+			{
+				context->swapchain->out_of_date = true;
+			}
+		});
 	}
 
 	// Creates a Vulkan instance for the context.
@@ -67,7 +84,7 @@ namespace gfx
 			VK_MAKE_VERSION(1, 0, 0), // application version
 			"furry engine", // engine name
 			VK_MAKE_VERSION(1, 0, 0), // engine version
-			VK_API_VERSION_1_0); // Vulkan API version
+			VK_API_VERSION_1_2); // Vulkan API version, 1.2 for timeline semaphores
 
 		std::vector<const char *> extensions = get_required_extensions();
 
@@ -0,0 +1,103 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <debug/allocations.h>
+#include <new>
+
+#ifdef VX_ALLOCATION_TEST
+namespace
+{
+	std::atomic<uint64_t> allocations = 0;
+
+	void *counted_allocate(std::size_t size, std::size_t alignment = 0)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+
+		// malloc doesn't like zero-sized allocations, and operator new has to return a unique pointer for them.
+		size = size == 0 ? 1 : size;
+
+		void *pointer = alignment > alignof(std::max_align_t)
+			? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+			: std::malloc(size);
+
+		if (pointer == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+
+		return pointer;
+	}
+}
+
+void *operator new(std::size_t size)
+{
+	return counted_allocate(size);
+}
+
+void *operator new[](std::size_t size)
+{
+	return counted_allocate(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+	return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return counted_allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept
+{
+	std::free(pointer);
+}
+#endif
+
+namespace gfx::debug
+{
+	uint64_t allocation_count()
+	{
+#ifdef VX_ALLOCATION_TEST
+		return allocations.load(std::memory_order_relaxed);
+#else
+		return 0;
+#endif
+	}
+}
@@ -0,0 +1,224 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <debug/zones.h>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+namespace
+{
+	struct event {
+		const char *name;
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	// the amount of events each thread keeps, older ones are overwritten once a thread has recorded more.
+	constexpr size_t ring_size = 1 << 14;
+
+	// a ring is only ever recorded into by its own thread, its lock is only contended while a trace is being written.
+	struct thread_ring {
+		uint32_t thread;
+
+		std::mutex mutex;
+		uint64_t written = 0;
+		std::array<event, ring_size> events;
+	};
+
+	// frame boundaries are recorded as events with this name, and written as instant events.
+	const char *const frame_marker = "frame";
+
+	std::atomic<bool> capturing = false;
+
+	// the time the running capture began at, zones from before it are left out of the trace.
+	std::atomic<uint64_t> capture_begin = 0;
+
+	// only touched by the thread that calls [mark_frame].
+	uint32_t frames_left = 0;
+	std::string capture_path;
+
+	// every ring that was ever created, they outlive their threads so a capture can still be written after they exit.
+	std::mutex rings_mutex;
+	std::vector<std::unique_ptr<thread_ring>> rings;
+
+	thread_local thread_ring *local_ring = nullptr;
+
+	uint64_t now()
+	{
+		static const auto epoch = std::chrono::steady_clock::now();
+
+		// 0 means "not captured", so the first possible timestamp is 1.
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count() + 1;
+	}
+
+	thread_ring &get_local_ring()
+	{
+		if (local_ring == nullptr)
+		{
+			std::lock_guard lock { rings_mutex };
+
+			auto ring = std::make_unique<thread_ring>();
+			ring->thread = static_cast<uint32_t>(rings.size());
+
+			local_ring = ring.get();
+			rings.push_back(std::move(ring));
+		}
+
+		return *local_ring;
+	}
+
+	void record(const char *name, uint64_t begin, uint64_t end)
+	{
+		thread_ring &ring = get_local_ring();
+		std::lock_guard lock { ring.mutex };
+
+		ring.events[ring.written % ring_size] = event { name, begin, end };
+		ring.written++;
+	}
+
+	// zone names are string literals, but a stray quote or backslash would still break the JSON.
+	void write_escaped(std::ofstream &file, const char *name)
+	{
+		for (const char *c = name; *c != '\0'; c++)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				file << '\\';
+			}
+
+			file << *c;
+		}
+	}
+}
+
+namespace gfx::debug
+{
+	zone::zone(const char *name)
+		: name { name }
+		, begin { capturing.load(std::memory_order_relaxed) ? now() : 0 }
+	{
+	}
+
+	zone::~zone()
+	{
+		if (begin != 0)
+		{
+			record(name, begin, now());
+		}
+	}
+
+	void capture_frames(uint32_t frames, const std::string &path)
+	{
+		// the first mark only starts the first frame, it takes one more to end the last one.
+		frames_left = frames + 1;
+		capture_path = path;
+
+		capture_begin.store(now(), std::memory_order_relaxed);
+		capturing.store(frames != 0, std::memory_order_release);
+
+		spdlog::info("capturing zones for {} frames, writing them to {}", frames, path);
+	}
+
+	void mark_frame()
+	{
+		if (!capturing.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		uint64_t time = now();
+		record(frame_marker, time, time);
+
+		if (--frames_left != 0)
+		{
+			return;
+		}
+
+		capturing.store(false, std::memory_order_release);
+
+		if (write_trace(capture_path))
+		{
+			spdlog::info("wrote zone capture to {}", capture_path);
+		}
+		else
+		{
+			spdlog::error("failed to write zone capture to {}", capture_path);
+		}
+	}
+
+	bool is_capturing()
+	{
+		return capturing.load(std::memory_order_relaxed);
+	}
+
+	bool write_trace(const std::string &path)
+	{
+		std::ofstream file(path, std::ios::trunc);
+
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		file << std::fixed << std::setprecision(3);
+
+		uint64_t first = capture_begin.load(std::memory_order_relaxed);
+		bool separate = false;
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+		std::lock_guard lock { rings_mutex };
+		std::vector<event> events;
+
+		for (const auto &ring : rings)
+		{
+			// zones may still be recorded while this runs, by worker threads or zones that began during the capture, so
+			// the ring is copied under its lock instead of holding that lock while writing the file.
+			{
+				std::lock_guard ring_lock { ring->mutex };
+
+				uint64_t oldest = ring->written > ring_size ? ring->written - ring_size : 0;
+				events.clear();
+
+				for (uint64_t i = oldest; i < ring->written; i++)
+				{
+					events.push_back(ring->events[i % ring_size]);
+				}
+			}
+
+			for (const event &event : events)
+			{
+				if (event.begin < first)
+				{
+					continue;
+				}
+
+				file << (separate ? ",\n" : "\n") << "{\"name\":\"";
+				write_escaped(file, event.name);
+
+				// trace_event timestamps are in microseconds, relative to the start of the capture.
+				double timestamp = (event.begin - first) / 1000.0;
+
+				if (event.name == frame_marker)
+				{
+					file << "\",\"ph\":\"i\",\"s\":\"g\",\"ts\":" << timestamp;
+				}
+				else
+				{
+					file << "\",\"ph\":\"X\",\"ts\":" << timestamp << ",\"dur\":" << (event.end - event.begin) / 1000.0;
+				}
+
+				file << ",\"pid\":0,\"tid\":" << ring->thread << "}";
+				separate = true;
+			}
+		}
+
+		file << "\n]}\n";
+
+		return file.good();
+	}
+}
@@ -1,5 +1,10 @@
 #include <algorithm>
+#include <array>
+#include <config.h>
+#include <cstring>
 #include <device.h>
+#include <filesystem>
+#include <fstream>
 #include <global.h>
 #include <optional>
 #include <set>
@@ -33,21 +38,157 @@ namespace gfx
 
 		std::tie(physical_device, indices) = suitable_device.value();
 		this->physical_device = physical_device;
+		this->queue_families = indices;
+
+		// every distinct family needs its own queue create info, even if we only use a single queue from each.
+		std::set<uint32_t> unique_families = {
+			indices.graphics_family.value(),
+			indices.present_family.value(),
+			indices.get_transfer_family(),
+		};
+
+		std::vector<vk::DeviceQueueCreateInfo> queue_create_infos;
+
+		for (uint32_t family : unique_families)
+		{
+			queue_create_infos.push_back(vk::DeviceQueueCreateInfo({}, family, 1, &queue_priority));
+		}
+
+		std::vector<const char *> extensions(device_extensions.begin(), device_extensions.end());
+
+		for (const auto &extension : physical_device.enumerateDeviceExtensionProperties())
+		{
+			for (const char *optional : optional_device_extensions)
+			{
+				if (strcmp(extension.extensionName, optional) == 0)
+				{
+					extensions.push_back(optional);
+				}
+			}
+		}
+
+		auto has_extension = [&](const char *name) {
+			return std::any_of(extensions.begin(), extensions.end(), [&](const char *extension) { return strcmp(extension, name) == 0; });
+		};
+
+		bool present_wait = has_extension(VK_KHR_PRESENT_ID_EXTENSION_NAME) && has_extension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+		bool pipeline_libraries = has_extension(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) && has_extension(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+
+		vk::PhysicalDeviceFeatures2 supported_features;
+		vk::PhysicalDevicePresentIdFeaturesKHR supported_present_id;
+		vk::PhysicalDevicePresentWaitFeaturesKHR supported_present_wait;
+		vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT supported_pipeline_library;
+
+		// the feature structs of an extension may only be queried if the device has it, so the query is chained the same
+		// way as the features that are enabled below.
+		void **query_chain = &supported_features.pNext;
+
+		if (present_wait)
+		{
+			supported_present_id.pNext = &supported_present_wait;
+			*query_chain = &supported_present_id;
+			query_chain = &supported_present_wait.pNext;
+		}
+
+		if (pipeline_libraries)
+		{
+			*query_chain = &supported_pipeline_library;
+			query_chain = &supported_pipeline_library.pNext;
+		}
+
+		physical_device.getFeatures2(&supported_features);
+
+		present_wait = present_wait && supported_present_id.presentId && supported_present_wait.presentWait;
+
+		// the extensions are useless without their features, and present_wait is useless without present_id.
+		if (!present_wait)
+		{
+			std::erase_if(extensions, [](const char *extension) {
+				return strcmp(extension, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0 || strcmp(extension, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0;
+			});
+		}
+
+		pipeline_libraries = pipeline_libraries && supported_pipeline_library.graphicsPipelineLibrary;
+
+		// pipelines are created whole without graphics pipeline libraries, see [swapchain/pipeline.h->gfx->pipeline].
+		if (!pipeline_libraries)
+		{
+			std::erase_if(extensions, [](const char *extension) {
+				return strcmp(extension, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) == 0 || strcmp(extension, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) == 0;
+			});
+		}
+
+		this->enabled_extensions = std::set<std::string>(extensions.begin(), extensions.end());
 
-		vk::DeviceQueueCreateInfo queue_create_info({}, 0, 1, &queue_priority);
 		vk::PhysicalDeviceFeatures device_features;
 
+		// pipeline statistics are optional, see [statistics.h->gfx->pipeline_statistics].
+		device_features.pipelineStatisticsQuery = supported_features.features.pipelineStatisticsQuery;
+		this->pipeline_statistics = device_features.pipelineStatisticsQuery;
+
+		// all CPU/GPU and cross-queue synchronization is done with timeline semaphores.
+		vk::PhysicalDeviceVulkan12Features vulkan12_features;
+		vulkan12_features.timelineSemaphore = VK_TRUE;
+
+		vk::PhysicalDevicePresentIdFeaturesKHR present_id_features { VK_TRUE };
+		vk::PhysicalDevicePresentWaitFeaturesKHR present_wait_features { VK_TRUE };
+		vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipeline_library_features { VK_TRUE };
+
+		// the optional feature structs are appended to the chain of the ones that are enabled.
+		void **chain = &vulkan12_features.pNext;
+
+		if (present_wait)
+		{
+			present_id_features.pNext = &present_wait_features;
+			*chain = &present_id_features;
+			chain = &present_wait_features.pNext;
+		}
+
+		if (pipeline_libraries)
+		{
+			*chain = &pipeline_library_features;
+			chain = &pipeline_library_features.pNext;
+		}
+
 		vk::DeviceCreateInfo device_create_info({},
-			static_cast<uint32_t>(1), &queue_create_info,
+			static_cast<uint32_t>(queue_create_infos.size()), queue_create_infos.data(),
 			0, nullptr, // validation layers, these will be filled later!
-			device_extensions.size(), device_extensions.data(),
+			static_cast<uint32_t>(extensions.size()), extensions.data(),
 			&device_features);
 
+		device_create_info.pNext = &vulkan12_features;
+
 		this->logical_device = physical_device.createDevice(device_create_info);
 		this->graphics_queue = logical_device.getQueue(indices.graphics_family.value(), 0);
 		this->present_queue = logical_device.getQueue(indices.present_family.value(), 0);
+		this->transfer_queue = logical_device.getQueue(indices.get_transfer_family(), 0);
+
+		if (present_wait)
+		{
+			this->wait_for_present = reinterpret_cast<PFN_vkWaitForPresentKHR>(logical_device.getProcAddr("vkWaitForPresentKHR"));
+			spdlog::info("enabled VK_KHR_present_wait, frames will be paced to the display");
+		}
+
+		if (pipeline_libraries)
+		{
+			auto properties = physical_device.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceGraphicsPipelineLibraryPropertiesEXT>();
+			this->pipeline_library = true;
+
+			spdlog::info("enabled VK_EXT_graphics_pipeline_library, pipelines will be fast-linked (fast linking {})",
+				properties.get<vk::PhysicalDeviceGraphicsPipelineLibraryPropertiesEXT>().graphicsPipelineLibraryFastLinking ? "supported" : "not guaranteed");
+		}
+
+		if (indices.transfer_family.has_value())
+		{
+			spdlog::info("using dedicated transfer queue family {}", indices.transfer_family.value());
+		}
 
 		this->init_vma(instance);
+		this->find_direct_write_memory();
+		this->staging = std::make_unique<gfx::staging_ring>(this, STAGING_RING_SIZE);
+		this->defrag = std::make_unique<gfx::defragmenter>(this);
+		this->load_pipeline_cache(PIPELINE_CACHE_PATH);
+		this->registry = std::make_unique<gfx::pipeline_registry>(this);
 	}
 
 	device::~device()
@@ -58,10 +199,124 @@ namespace gfx
 	void device::cleanup()
 	{
 		spdlog::info("cleaning up gfx::device");
+
+		registry.reset();
+
+		if (pipeline_cache)
+		{
+			this->save_pipeline_cache();
+			logical_device.destroyPipelineCache(pipeline_cache);
+			this->pipeline_cache = nullptr;
+		}
+
+		defrag.reset();
+		staging.reset();
+		vmaDestroyAllocator(allocator);
 		logical_device.destroy();
 		spdlog::info("... done!");
 	}
 
+	void device::load_pipeline_cache(const std::string &path)
+	{
+		std::vector<char> data;
+		std::ifstream file(path, std::ios::ate | std::ios::binary);
+
+		if (file.is_open())
+		{
+			data.resize(static_cast<size_t>(file.tellg()));
+			file.seekg(0);
+			file.read(data.data(), data.size());
+		}
+
+		// drivers are supposed to reject caches that aren't theirs, but not all of them do, so we check the header ourselves.
+		if (!data.empty())
+		{
+			vk::PhysicalDeviceProperties properties = physical_device.getProperties();
+			VkPipelineCacheHeaderVersionOne header {};
+
+			if (data.size() >= sizeof(header))
+			{
+				std::memcpy(&header, data.data(), sizeof(header));
+			}
+
+			bool valid = data.size() >= sizeof(header)
+				&& header.headerSize >= sizeof(header)
+				&& header.headerSize <= data.size()
+				&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+				&& header.vendorID == properties.vendorID
+				&& header.deviceID == properties.deviceID
+				&& std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+
+			if (!valid)
+			{
+				spdlog::warn("discarding pipeline cache {}, it was written for a different device or driver", path);
+				data.clear();
+			}
+		}
+
+		vk::PipelineCacheCreateInfo cache_info({}, data.size(), data.data());
+		this->pipeline_cache = logical_device.createPipelineCache(cache_info);
+		this->pipeline_cache_warm = !data.empty();
+
+		if (pipeline_cache_warm)
+		{
+			spdlog::info("loaded pipeline cache from {} ({} KiB)", path, data.size() / 1024);
+		}
+		else
+		{
+			spdlog::info("no pipeline cache at {}, pipelines will be compiled from scratch", path);
+		}
+	}
+
+	void device::merge_pipeline_cache(vk::PipelineCache cache)
+	{
+		std::lock_guard lock { pipeline_cache_mutex };
+		logical_device.mergePipelineCaches(pipeline_cache, cache);
+	}
+
+	bool device::save_pipeline_cache(const std::string &path)
+	{
+		std::vector<uint8_t> data;
+
+		// this runs from [cleanup] (and so from the destructor), a lost device or lack of memory must not escape it.
+		try
+		{
+			std::lock_guard lock { pipeline_cache_mutex };
+			data = logical_device.getPipelineCacheData(pipeline_cache);
+		} catch (const std::exception &error)
+		{
+			spdlog::warn("unable to read back the pipeline cache, it won't be saved: {}", error.what());
+			return false;
+		}
+
+		std::string temporary_path = path + ".tmp";
+
+		{
+			std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char *>(data.data()), data.size());
+
+			if (!file.good())
+			{
+				spdlog::warn("failed to write pipeline cache to {}", temporary_path);
+				return false;
+			}
+		}
+
+		// a rename within the same directory replaces the old cache atomically.
+		std::error_code error;
+		std::filesystem::rename(temporary_path, path, error);
+
+		if (error)
+		{
+			spdlog::warn("failed to replace pipeline cache {}: {}", path, error.message());
+			std::filesystem::remove(temporary_path, error);
+			return false;
+		}
+
+		spdlog::info("saved pipeline cache to {} ({} KiB)", path, data.size() / 1024);
+		return true;
+	}
+
 	std::optional<std::pair<vk::PhysicalDevice, gfx::queue_family_indices>> device::find_most_suitable(
 		const std::vector<vk::PhysicalDevice> devices,
 		const vk::SurfaceKHR *surface)
@@ -79,6 +334,12 @@ namespace gfx
 				continue;
 			}
 
+			if (!supports_timeline_semaphores(device))
+			{
+				spdlog::warn("skipping device {}, it doesn't support Vulkan 1.2 timeline semaphores", device.getProperties().deviceName);
+				continue;
+			}
+
 			// Evaluate device properties to determine its score
 			gfx::queue_family_indices indices = this->find_queue_families(surface, device);
 			int score = evaluate_device(device, indices);
@@ -117,19 +378,25 @@ namespace gfx
 
 		for (const auto &queue_family : queue_family_properties)
 		{
-			if (queue_family.queueFlags & vk::QueueFlagBits::eGraphics)
+			if (!indices.graphics_family.has_value() && queue_family.queueFlags & vk::QueueFlagBits::eGraphics)
 			{
 				indices.graphics_family = i;
 			}
 
-			if (device->getSurfaceSupportKHR(i, *surface))
+			if (!indices.present_family.has_value() && device->getSurfaceSupportKHR(i, *surface))
 			{
 				indices.present_family = i;
 			}
 
-			if (indices.is_complete())
+			// prefer a transfer-only family (usually backed by a DMA engine) over one that also supports compute.
+			if (queue_family.queueFlags & vk::QueueFlagBits::eTransfer && !(queue_family.queueFlags & vk::QueueFlagBits::eGraphics))
 			{
-				break;
+				bool transfer_only = !(queue_family.queueFlags & vk::QueueFlagBits::eCompute);
+
+				if (!indices.transfer_family.has_value() || transfer_only)
+				{
+					indices.transfer_family = i;
+				}
 			}
 
 			i++;
@@ -138,6 +405,17 @@ namespace gfx
 		return indices;
 	}
 
+	bool device::supports_timeline_semaphores(vk::PhysicalDevice physical_device)
+	{
+		if (physical_device.getProperties().apiVersion < VK_API_VERSION_1_2)
+		{
+			return false;
+		}
+
+		auto features = physical_device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+		return features.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore;
+	}
+
 	uint32_t device::evaluate_device(vk::PhysicalDevice physical_device, gfx::queue_family_indices indices)
 	{
 		int evaluation = 0;
@@ -169,11 +447,109 @@ namespace gfx
 		info.instance = static_cast<VkInstance>(*instance);
 		info.physicalDevice = this->physical_device;
 		info.device = this->logical_device;
+		info.vulkanApiVersion = VK_API_VERSION_1_2;
 		// info.flags |= VMA_ALLOCATOR_CREATE_KHR_DEDICATED_ALLOCATION_BIT | VMA_ALLOCATOR_CREATE_KHR_BIND_MEMORY2_BIT;
 
+		if (this->has_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+		{
+			spdlog::info("enabling VK_EXT_memory_budget for VMA");
+			info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+		}
+
 		VmaAllocator allocator;
 		vmaCreateAllocator(&info, &allocator);
 
 		this->allocator = allocator;
 	}
+
+	void device::find_direct_write_memory()
+	{
+		vk::PhysicalDeviceMemoryProperties properties = physical_device.getMemoryProperties();
+
+		// only consider the largest device-local heap, the 256MB BAR window of GPUs without ReBAR is too small to live in.
+		uint32_t largest_heap = 0;
+		vk::DeviceSize largest_size = 0;
+
+		for (uint32_t i = 0; i < properties.memoryHeapCount; i++)
+		{
+			if (properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal && properties.memoryHeaps[i].size > largest_size)
+			{
+				largest_heap = i;
+				largest_size = properties.memoryHeaps[i].size;
+			}
+		}
+
+		vk::MemoryPropertyFlags direct_flags = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible;
+
+		for (uint32_t i = 0; i < properties.memoryTypeCount; i++)
+		{
+			const vk::MemoryType &type = properties.memoryTypes[i];
+
+			if ((type.propertyFlags & direct_flags) == direct_flags && type.heapIndex == largest_heap)
+			{
+				this->direct_write_memory_types |= 1u << i;
+			}
+		}
+
+		if (this->direct_write_memory_types != 0)
+		{
+			spdlog::info("device has host-visible device-local memory, uploads will be written directly");
+		}
+	}
+
+	std::vector<gfx::heap_statistics> device::get_memory_statistics()
+	{
+		const VkPhysicalDeviceMemoryProperties *properties;
+		vmaGetMemoryProperties(allocator, &properties);
+
+		std::vector<VmaBudget> budgets(properties->memoryHeapCount);
+		vmaGetHeapBudgets(allocator, budgets.data());
+
+		std::vector<gfx::heap_statistics> statistics;
+
+		for (uint32_t i = 0; i < properties->memoryHeapCount; i++)
+		{
+			statistics.push_back(gfx::heap_statistics {
+				i,
+				static_cast<vk::MemoryHeapFlags>(properties->memoryHeaps[i].flags),
+				budgets[i].usage,
+				budgets[i].budget,
+				budgets[i].statistics.blockCount,
+				budgets[i].statistics.allocationCount,
+				budgets[i].statistics.blockBytes,
+				budgets[i].statistics.allocationBytes,
+			});
+		}
+
+		return statistics;
+	}
+
+	bool device::has_budget_for(uint32_t memory_type, vk::DeviceSize size, float threshold)
+	{
+		const VkPhysicalDeviceMemoryProperties *properties;
+		vmaGetMemoryProperties(allocator, &properties);
+
+		if (memory_type >= properties->memoryTypeCount)
+		{
+			throw std::runtime_error("memory type " + std::to_string(memory_type) + " doesn't exist!");
+		}
+
+		// only the heap the memory type allocates from matters, other heaps being full doesn't keep this one from fitting.
+		std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets;
+		vmaGetHeapBudgets(allocator, budgets.data());
+
+		const VmaBudget &heap = budgets[properties->memoryTypes[memory_type].heapIndex];
+		return static_cast<double>(heap.usage + size) <= static_cast<double>(heap.budget) * threshold;
+	}
+
+	std::string device::dump_memory_statistics(bool detailed)
+	{
+		char *json;
+		vmaBuildStatsString(allocator, &json, detailed ? VK_TRUE : VK_FALSE);
+
+		std::string result(json);
+		vmaFreeStatsString(allocator, json);
+
+		return result;
+	}
 }
@@ -0,0 +1,688 @@
+#include <algorithm>
+#include <debug/zones.h>
+#include <graph/graph.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace gfx
+{
+	namespace
+	{
+		// the stages and writes of every kind of attachment. the first use of a transient attachment in a frame waits on
+		// these, as the memory may still be in use by the last frame, or by another attachment it's aliased with.
+		constexpr vk::PipelineStageFlags transient_stages = vk::PipelineStageFlagBits::eColorAttachmentOutput
+			| vk::PipelineStageFlagBits::eEarlyFragmentTests
+			| vk::PipelineStageFlagBits::eLateFragmentTests
+			| vk::PipelineStageFlagBits::eFragmentShader;
+
+		constexpr vk::AccessFlags transient_writes = vk::AccessFlagBits::eColorAttachmentWrite
+			| vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+
+		bool has_depth(vk::Format format)
+		{
+			switch (format)
+			{
+			case vk::Format::eD16Unorm:
+			case vk::Format::eX8D24UnormPack32:
+			case vk::Format::eD32Sfloat:
+			case vk::Format::eD16UnormS8Uint:
+			case vk::Format::eD24UnormS8Uint:
+			case vk::Format::eD32SfloatS8Uint:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		bool has_stencil(vk::Format format)
+		{
+			return format == vk::Format::eD16UnormS8Uint
+				|| format == vk::Format::eD24UnormS8Uint
+				|| format == vk::Format::eD32SfloatS8Uint
+				|| format == vk::Format::eS8Uint;
+		}
+
+		vk::ImageUsageFlags get_image_usage(gfx::resource_usage usage)
+		{
+			switch (usage)
+			{
+			case gfx::resource_usage::color_write:
+				return vk::ImageUsageFlagBits::eColorAttachment;
+			case gfx::resource_usage::depth_write:
+			case gfx::resource_usage::depth_read:
+				return vk::ImageUsageFlagBits::eDepthStencilAttachment;
+			case gfx::resource_usage::sampled:
+				return vk::ImageUsageFlagBits::eSampled;
+			}
+
+			return {};
+		}
+	}
+
+	render_graph::render_graph(std::shared_ptr<gfx::swapchain> swapchain, std::shared_ptr<gfx::commands> commands)
+		: device { swapchain->device }
+		, swapchain { swapchain }
+		, commands { commands }
+	{
+	}
+
+	render_graph::~render_graph()
+	{
+		this->cleanup();
+	}
+
+	gfx::graph_resource render_graph::import_swapchain()
+	{
+		if (!swapchain_resource)
+		{
+			this->swapchain_resource = static_cast<gfx::graph_resource>(images.size());
+			this->images.push_back(gfx::graph_image { "swapchain", swapchain->image_format, 1.0f, true, true });
+		}
+
+		return *swapchain_resource;
+	}
+
+	gfx::graph_resource render_graph::create_attachment(const std::string &name, vk::Format format, float scale)
+	{
+		this->images.push_back(gfx::graph_image { name, format, scale });
+		return static_cast<gfx::graph_resource>(images.size() - 1);
+	}
+
+	void render_graph::mark_output(gfx::graph_resource resource)
+	{
+		this->images.at(resource).output = true;
+	}
+
+	gfx::graph_pass &render_graph::add_pass(const std::string &name)
+	{
+		if (compiled)
+		{
+			throw std::runtime_error("can't add passes to a render graph after it has been compiled!");
+		}
+
+		return *passes.emplace_back(std::make_unique<gfx::graph_pass>(name));
+	}
+
+	void render_graph::compile()
+	{
+		VX_ZONE("render_graph::compile");
+
+		if (compiled)
+		{
+			throw std::runtime_error("render graph was already compiled!");
+		}
+
+		for (const auto &pass : passes)
+		{
+			for (const auto &use : pass->uses)
+			{
+				if (use.resource >= images.size())
+				{
+					throw std::runtime_error("render graph pass '" + pass->name + "' uses a resource that doesn't exist!");
+				}
+			}
+		}
+
+		this->cull();
+		this->create_render_passes();
+		this->create_resources();
+
+		this->generation = swapchain->generation;
+		this->compiled = true;
+	}
+
+	void render_graph::cull()
+	{
+		// walk the passes backwards, keeping every pass that writes something a pass after it (or the frame) needs.
+		std::vector<bool> needed(images.size());
+
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			needed[i] = images[i].output;
+		}
+
+		for (auto it = passes.rbegin(); it != passes.rend(); it++)
+		{
+			gfx::graph_pass &pass = **it;
+
+			pass.active = pass.side_effects || std::any_of(pass.uses.begin(), pass.uses.end(), [&](const auto &use) {
+				return !gfx::is_read(use.usage) && needed[use.resource];
+			});
+
+			if (!pass.active)
+			{
+				spdlog::info("culled render graph pass '{}', nothing uses what it writes", pass.name);
+				continue;
+			}
+
+			// a cleared attachment doesn't need whatever was written to it before, anything that's loaded or read does.
+			for (const auto &use : pass.uses)
+			{
+				if (!gfx::is_read(use.usage) && use.clear)
+				{
+					needed[use.resource] = false;
+				}
+			}
+
+			for (const auto &use : pass.uses)
+			{
+				if (gfx::is_read(use.usage) || !use.clear)
+				{
+					needed[use.resource] = true;
+				}
+			}
+		}
+
+		this->order.clear();
+
+		for (auto &pass : passes)
+		{
+			if (pass->active)
+			{
+				order.push_back(pass.get());
+			}
+		}
+	}
+
+	void render_graph::create_render_passes()
+	{
+		for (uint32_t index = 0; index < order.size(); index++)
+		{
+			for (const auto &use : order[index]->uses)
+			{
+				gfx::graph_image &image = images[use.resource];
+
+				image.first_use = std::min(image.first_use, index);
+				image.last_use = std::max(image.last_use, index);
+				image.usage |= get_image_usage(use.usage);
+			}
+		}
+
+		// returns the first use of [resource] by a pass after [index], if there is one.
+		auto find_next_use = [&](gfx::graph_resource resource, uint32_t index) -> const gfx::graph_pass::use * {
+			for (uint32_t next = index + 1; next < order.size(); next++)
+			{
+				for (const auto &use : order[next]->uses)
+				{
+					if (use.resource == resource)
+					{
+						return &use;
+					}
+				}
+			}
+
+			return nullptr;
+		};
+
+		// what happened to each image so far, the uses of a pass are synchronized against this.
+		struct image_state {
+			vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+			bool written = false;
+			vk::PipelineStageFlags stages;
+			vk::AccessFlags writes;
+		};
+
+		std::vector<image_state> states(images.size());
+
+		for (uint32_t index = 0; index < order.size(); index++)
+		{
+			gfx::graph_pass &pass = *order[index];
+
+			std::vector<vk::AttachmentDescription> descriptions;
+			std::vector<vk::AttachmentReference> color_references;
+			std::optional<vk::AttachmentReference> depth_reference;
+			std::optional<float> scale;
+
+			// everything this pass does waits on the previous uses of its resources, and any layout transition at the end
+			// of the pass is made visible to the next use.
+			vk::SubpassDependency incoming { VK_SUBPASS_EXTERNAL, 0 };
+			vk::SubpassDependency outgoing { 0, VK_SUBPASS_EXTERNAL };
+
+			pass.attachments.clear();
+			pass.clear_values.clear();
+
+			for (const auto &use : pass.uses)
+			{
+				gfx::graph_image &image = images[use.resource];
+				image_state &state = states[use.resource];
+
+				if (gfx::is_read(use.usage) && !state.written)
+				{
+					throw std::runtime_error("render graph pass '" + pass.name + "' reads '" + image.name + "' before anything has written to it!");
+				}
+
+				if (state.stages)
+				{
+					incoming.srcStageMask |= state.stages;
+					incoming.srcAccessMask |= state.writes;
+				}
+				else if (image.imported)
+				{
+					// the stage the frame waits for the swapchain image to be acquired at.
+					incoming.srcStageMask |= vk::PipelineStageFlagBits::eColorAttachmentOutput;
+				}
+				else
+				{
+					incoming.srcStageMask |= transient_stages;
+					incoming.srcAccessMask |= transient_writes;
+				}
+
+				incoming.dstStageMask |= gfx::get_stages(use.usage);
+				incoming.dstAccessMask |= gfx::get_access(use.usage);
+
+				state.stages = gfx::get_stages(use.usage);
+				state.writes = gfx::is_read(use.usage) ? vk::AccessFlags {} : gfx::get_access(use.usage);
+
+				// sampled images aren't attachments, the pass that wrote them already left them in the right layout.
+				if (use.usage == gfx::resource_usage::sampled)
+				{
+					continue;
+				}
+
+				if (scale && *scale != image.scale)
+				{
+					throw std::runtime_error("the attachments of render graph pass '" + pass.name + "' have different sizes!");
+				}
+
+				scale = image.scale;
+				pass.uses_swapchain = pass.uses_swapchain || image.imported;
+
+				const gfx::graph_pass::use *next = find_next_use(use.resource, index);
+				vk::ImageLayout layout = gfx::get_layout(use.usage);
+
+				// only load what was written before, and only store what's used after.
+				vk::AttachmentLoadOp load = use.clear ? vk::AttachmentLoadOp::eClear
+					: state.written ? vk::AttachmentLoadOp::eLoad
+									: vk::AttachmentLoadOp::eDontCare;
+
+				vk::AttachmentStoreOp store = next || image.output ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+
+				// the contents only have to be preserved if they're loaded, otherwise the transition can discard them.
+				vk::ImageLayout initial_layout = load == vk::AttachmentLoadOp::eLoad ? state.layout : vk::ImageLayout::eUndefined;
+				vk::ImageLayout final_layout = layout;
+
+				if (next && next->usage == gfx::resource_usage::sampled)
+				{
+					final_layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+				}
+				else if (!next && image.imported)
+				{
+					final_layout = vk::ImageLayout::ePresentSrcKHR;
+				}
+
+				bool stencil = has_stencil(image.format);
+
+				descriptions.push_back(vk::AttachmentDescription {
+					{},
+					image.format,
+					vk::SampleCountFlagBits::e1,
+					load,
+					store,
+					stencil ? load : vk::AttachmentLoadOp::eDontCare,
+					stencil ? store : vk::AttachmentStoreOp::eDontCare,
+					initial_layout,
+					final_layout,
+				});
+
+				vk::AttachmentReference reference { static_cast<uint32_t>(descriptions.size() - 1), layout };
+
+				if (use.usage == gfx::resource_usage::color_write)
+				{
+					color_references.push_back(reference);
+				}
+				else if (depth_reference)
+				{
+					throw std::runtime_error("render graph pass '" + pass.name + "' uses more than one depth attachment!");
+				}
+				else
+				{
+					depth_reference = reference;
+				}
+
+				if (final_layout != layout && next)
+				{
+					outgoing.srcStageMask |= gfx::get_stages(use.usage);
+					outgoing.srcAccessMask |= state.writes;
+					outgoing.dstStageMask |= gfx::get_stages(next->usage);
+					outgoing.dstAccessMask |= gfx::get_access(next->usage);
+				}
+
+				state.layout = final_layout;
+				state.written = state.written || !gfx::is_read(use.usage);
+
+				pass.attachments.push_back(use.resource);
+				pass.clear_values.push_back(use.clear.value_or(vk::ClearValue {}));
+			}
+
+			if (descriptions.empty())
+			{
+				throw std::runtime_error("render graph pass '" + pass.name + "' doesn't render to anything!");
+			}
+
+			pass.scale = *scale;
+
+			vk::SubpassDescription subpass {
+				{},
+				vk::PipelineBindPoint::eGraphics,
+				0,
+				nullptr,
+				static_cast<uint32_t>(color_references.size()),
+				color_references.data(),
+				nullptr,
+				depth_reference ? &*depth_reference : nullptr,
+			};
+
+			std::vector<vk::SubpassDependency> dependencies { incoming };
+
+			if (outgoing.srcStageMask)
+			{
+				dependencies.push_back(outgoing);
+			}
+
+			vk::RenderPassCreateInfo info {
+				{},
+				static_cast<uint32_t>(descriptions.size()),
+				descriptions.data(),
+				1,
+				&subpass,
+				static_cast<uint32_t>(dependencies.size()),
+				dependencies.data(),
+			};
+
+			pass.pass = device->get_logical_device().createRenderPass(info);
+		}
+	}
+
+	void render_graph::create_resources()
+	{
+		vk::Device logical_device = device->get_logical_device();
+		VmaAllocator allocator = device->get_vma_allocator();
+
+		std::vector<gfx::graph_resource> transient;
+
+		for (gfx::graph_resource resource = 0; resource < images.size(); resource++)
+		{
+			if (!images[resource].imported && images[resource].first_use != UINT32_MAX)
+			{
+				transient.push_back(resource);
+			}
+		}
+
+		// assign the attachments to memory slots in the order they're first used, an attachment can reuse any slot
+		// whose last attachment is no longer used by then.
+		std::sort(transient.begin(), transient.end(), [&](gfx::graph_resource a, gfx::graph_resource b) {
+			return images[a].first_use < images[b].first_use;
+		});
+
+		this->slots.clear();
+		vk::DeviceSize unaliased_size = 0;
+
+		for (gfx::graph_resource resource : transient)
+		{
+			gfx::graph_image &image = images[resource];
+
+			vk::ImageCreateInfo image_info {
+				{},
+				vk::ImageType::e2D,
+				image.format,
+				vk::Extent3D {
+					static_cast<uint32_t>(swapchain->extent.width * image.scale),
+					static_cast<uint32_t>(swapchain->extent.height * image.scale),
+					1,
+				},
+				1,
+				1,
+				vk::SampleCountFlagBits::e1,
+				vk::ImageTiling::eOptimal,
+				image.usage,
+				vk::SharingMode::eExclusive,
+			};
+
+			image.image = logical_device.createImage(image_info);
+
+			vk::MemoryRequirements requirements = logical_device.getImageMemoryRequirements(image.image);
+			unaliased_size += requirements.size;
+
+			// outputs are used after the graph, so they never share their memory.
+			auto slot = std::find_if(slots.begin(), slots.end(), [&](const memory_slot &slot) {
+				return !image.output && slot.last_use < image.first_use && (slot.requirements.memoryTypeBits & requirements.memoryTypeBits) != 0;
+			});
+
+			if (slot == slots.end())
+			{
+				image.slot = static_cast<uint32_t>(slots.size());
+				slots.push_back(memory_slot { requirements });
+			}
+			else
+			{
+				image.slot = static_cast<uint32_t>(slot - slots.begin());
+
+				slot->requirements.size = std::max(slot->requirements.size, requirements.size);
+				slot->requirements.alignment = std::max(slot->requirements.alignment, requirements.alignment);
+				slot->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+			}
+
+			slots[image.slot].last_use = image.output ? UINT32_MAX : image.last_use;
+		}
+
+		vk::DeviceSize aliased_size = 0;
+
+		for (auto &slot : slots)
+		{
+			VmaAllocationCreateInfo alloc_info {};
+			alloc_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+			VkMemoryRequirements requirements = slot.requirements;
+
+			if (vmaAllocateMemory(allocator, &requirements, &alloc_info, &slot.allocation, nullptr) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate memory for the render graph's attachments!");
+			}
+
+			aliased_size += slot.requirements.size;
+		}
+
+		for (gfx::graph_resource resource : transient)
+		{
+			gfx::graph_image &image = images[resource];
+
+			if (vmaBindImageMemory(allocator, slots[image.slot].allocation, image.image) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to bind the memory of render graph attachment '" + image.name + "'!");
+			}
+
+			vk::ImageViewCreateInfo view_info {
+				{},
+				image.image,
+				vk::ImageViewType::e2D,
+				image.format,
+				vk::ComponentMapping {},
+				vk::ImageSubresourceRange {
+					has_depth(image.format) ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor,
+					0,
+					1,
+					0,
+					1,
+				},
+			};
+
+			image.view = logical_device.createImageView(view_info);
+		}
+
+		for (gfx::graph_pass *pass : order)
+		{
+			pass->extent = vk::Extent2D {
+				static_cast<uint32_t>(swapchain->extent.width * pass->scale),
+				static_cast<uint32_t>(swapchain->extent.height * pass->scale),
+			};
+
+			size_t count = pass->uses_swapchain ? swapchain->image_views.size() : 1;
+			std::vector<vk::ImageView> views(pass->attachments.size());
+
+			pass->framebuffers.resize(count);
+
+			for (size_t i = 0; i < count; i++)
+			{
+				for (size_t attachment = 0; attachment < pass->attachments.size(); attachment++)
+				{
+					const gfx::graph_image &image = images[pass->attachments[attachment]];
+					views[attachment] = image.imported ? swapchain->image_views[i] : image.view;
+				}
+
+				vk::FramebufferCreateInfo framebuffer_info {
+					{},
+					pass->pass,
+					static_cast<uint32_t>(views.size()),
+					views.data(),
+					pass->extent.width,
+					pass->extent.height,
+					1,
+				};
+
+				pass->framebuffers[i] = logical_device.createFramebuffer(framebuffer_info);
+			}
+		}
+
+		spdlog::info("render graph: {} of {} passes active, {} attachments in {} allocations ({} KiB, {} KiB without aliasing)",
+			order.size(),
+			passes.size(),
+			transient.size(),
+			slots.size(),
+			aliased_size / 1024,
+			unaliased_size / 1024);
+
+		if (on_recreate)
+		{
+			this->on_recreate();
+		}
+	}
+
+	void render_graph::destroy_resources(gfx::deletion_queue *deletion_queue)
+	{
+		vk::Device logical_device = device->get_logical_device();
+		VmaAllocator allocator = device->get_vma_allocator();
+
+		// without a queue the device has to be idle, and everything goes right away.
+		auto release = [&](auto deleter) {
+			if (deletion_queue)
+			{
+				deletion_queue->push(deleter);
+			}
+			else
+			{
+				deleter();
+			}
+		};
+
+		for (gfx::graph_pass *pass : order)
+		{
+			for (vk::Framebuffer framebuffer : pass->framebuffers)
+			{
+				release([=]() { logical_device.destroyFramebuffer(framebuffer); });
+			}
+
+			pass->framebuffers.clear();
+		}
+
+		for (auto &image : images)
+		{
+			if (image.imported || !image.image)
+			{
+				continue;
+			}
+
+			release([=, view = image.view, handle = image.image]() {
+				logical_device.destroyImageView(view);
+				logical_device.destroyImage(handle);
+			});
+
+			image.view = nullptr;
+			image.image = nullptr;
+		}
+
+		for (auto &slot : slots)
+		{
+			release([=, allocation = slot.allocation]() { vmaFreeMemory(allocator, allocation); });
+		}
+
+		this->slots.clear();
+	}
+
+	void render_graph::execute(vk::CommandBuffer *buffer, uint32_t image_index)
+	{
+		VX_ZONE("render_graph::execute");
+
+		if (!compiled)
+		{
+			throw std::runtime_error("render graph has to be compiled before it's executed!");
+		}
+
+		// the attachments are sized for the swapchain, the frames still in flight may use the old ones.
+		if (generation != swapchain->generation)
+		{
+			this->destroy_resources(commands->deletion_queue.get());
+			this->create_resources();
+			this->generation = swapchain->generation;
+		}
+
+		for (gfx::graph_pass *pass : order)
+		{
+			uint32_t scope = swapchain->profiler ? swapchain->profiler->begin_scope(*buffer, pass->name.c_str()) : gfx::gpu_profiler::invalid_scope;
+
+			vk::Rect2D area { { 0, 0 }, pass->extent };
+			pass->framebuffer = pass->framebuffers[pass->uses_swapchain ? image_index : 0];
+
+			vk::RenderPassBeginInfo begin_info {
+				pass->pass,
+				pass->framebuffer,
+				area,
+				static_cast<uint32_t>(pass->clear_values.size()),
+				pass->clear_values.data(),
+			};
+
+			buffer->beginRenderPass(begin_info, pass->contents);
+
+			// secondary command buffers set their own dynamic state, nothing but executing them is allowed here.
+			if (pass->contents == vk::SubpassContents::eInline)
+			{
+				buffer->setViewport(0, vk::Viewport { 0.0f, 0.0f, static_cast<float>(pass->extent.width), static_cast<float>(pass->extent.height), 0.0f, 1.0f });
+				buffer->setScissor(0, area);
+			}
+
+			if (pass->callback)
+			{
+				pass->callback(buffer);
+			}
+
+			buffer->endRenderPass();
+			pass->framebuffer = nullptr;
+
+			if (swapchain->profiler)
+			{
+				swapchain->profiler->end_scope(*buffer, scope);
+			}
+		}
+	}
+
+	void render_graph::cleanup()
+	{
+		if (!compiled)
+		{
+			return;
+		}
+
+		spdlog::info("cleaning up gfx::render_graph");
+
+		device->get_logical_device().waitIdle();
+		this->destroy_resources(nullptr);
+
+		for (gfx::graph_pass *pass : order)
+		{
+			device->get_logical_device().destroyRenderPass(pass->pass);
+			pass->pass = nullptr;
+		}
+
+		this->compiled = false;
+		spdlog::info("... done!");
+	}
+}
@@ -0,0 +1,116 @@
+#include <graph/pass.h>
+#include <graph/resource.h>
+
+namespace gfx
+{
+	vk::ImageLayout get_layout(gfx::resource_usage usage)
+	{
+		switch (usage)
+		{
+		case gfx::resource_usage::color_write:
+			return vk::ImageLayout::eColorAttachmentOptimal;
+		case gfx::resource_usage::depth_write:
+			return vk::ImageLayout::eDepthStencilAttachmentOptimal;
+		case gfx::resource_usage::depth_read:
+			return vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+		case gfx::resource_usage::sampled:
+			return vk::ImageLayout::eShaderReadOnlyOptimal;
+		}
+
+		return vk::ImageLayout::eUndefined;
+	}
+
+	vk::PipelineStageFlags get_stages(gfx::resource_usage usage)
+	{
+		switch (usage)
+		{
+		case gfx::resource_usage::color_write:
+			return vk::PipelineStageFlagBits::eColorAttachmentOutput;
+		case gfx::resource_usage::depth_write:
+		case gfx::resource_usage::depth_read:
+			return vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+		case gfx::resource_usage::sampled:
+			return vk::PipelineStageFlagBits::eFragmentShader;
+		}
+
+		return vk::PipelineStageFlagBits::eTopOfPipe;
+	}
+
+	vk::AccessFlags get_access(gfx::resource_usage usage)
+	{
+		switch (usage)
+		{
+		case gfx::resource_usage::color_write:
+			return vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+		case gfx::resource_usage::depth_write:
+			return vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+		case gfx::resource_usage::depth_read:
+			return vk::AccessFlagBits::eDepthStencilAttachmentRead;
+		case gfx::resource_usage::sampled:
+			return vk::AccessFlagBits::eShaderRead;
+		}
+
+		return {};
+	}
+
+	bool is_read(gfx::resource_usage usage)
+	{
+		return usage == gfx::resource_usage::depth_read || usage == gfx::resource_usage::sampled;
+	}
+
+	graph_pass &graph_pass::write_color(gfx::graph_resource resource, std::optional<vk::ClearColorValue> clear)
+	{
+		std::optional<vk::ClearValue> value;
+
+		if (clear)
+		{
+			value = vk::ClearValue { *clear };
+		}
+
+		this->uses.push_back(use { resource, gfx::resource_usage::color_write, value });
+		return *this;
+	}
+
+	graph_pass &graph_pass::write_depth(gfx::graph_resource resource, std::optional<vk::ClearDepthStencilValue> clear)
+	{
+		std::optional<vk::ClearValue> value;
+
+		if (clear)
+		{
+			value = vk::ClearValue { *clear };
+		}
+
+		this->uses.push_back(use { resource, gfx::resource_usage::depth_write, value });
+		return *this;
+	}
+
+	graph_pass &graph_pass::read_depth(gfx::graph_resource resource)
+	{
+		this->uses.push_back(use { resource, gfx::resource_usage::depth_read, std::nullopt });
+		return *this;
+	}
+
+	graph_pass &graph_pass::read(gfx::graph_resource resource)
+	{
+		this->uses.push_back(use { resource, gfx::resource_usage::sampled, std::nullopt });
+		return *this;
+	}
+
+	graph_pass &graph_pass::execute(std::function<void(vk::CommandBuffer *buffer)> callback)
+	{
+		this->callback = std::move(callback);
+		return *this;
+	}
+
+	graph_pass &graph_pass::keep()
+	{
+		this->side_effects = true;
+		return *this;
+	}
+
+	graph_pass &graph_pass::record_secondary()
+	{
+		this->contents = vk::SubpassContents::eSecondaryCommandBuffers;
+		return *this;
+	}
+}
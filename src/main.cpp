@@ -1,17 +1,26 @@
 #include "buffer/uniform.h"
 #include "uniform/pool.h"
 #define VMA_IMPLEMENTATION
-#define VMA_VULKAN_VERSION 1003000
+#define VMA_VULKAN_VERSION 1002000
 #define VMA_DEBUG_REPORT 1
 #include <GLFW/glfw3.h>
+#include <buffer/arena.h>
 #include <buffer/buffer.h>
 #include <buffer/index.h>
 #include <context.h>
+#include <debug/allocations.h>
+#include <debug/zones.h>
+#include <cstdlib>
 #include <device.h>
+#include <graph/graph.h>
 #include <memory>
+#include <parallel.h>
 #include <render.h>
 #include <spdlog/spdlog.h>
+#include <thread_pool.h>
 #include <swapchain/swapchain.h>
+#include <swapchain/watcher.h>
+#include <uniform/ring.h>
 #include <uniform/set.h>
 #include <util.h>
 #include <vertex.h>
@@ -38,6 +47,24 @@ const std::vector<uint16_t> indices = {
 	0, 1, 2, 2, 3, 0,
 	4, 5, 6, 6, 7, 4
 };
+
+// A render graph pass that draws a single triangle covering the target, with [frag_shader] sampling [source].
+// The view of [source] changes whenever the swapchain is recreated, while the frames still in flight may use the old
+// one, so there's a descriptor set per frame in flight, each rewritten the next time its frame comes around.
+struct fullscreen_pass {
+	gfx::graph_resource source;
+	std::string frag_shader;
+
+	gfx::graph_pass *pass = nullptr;
+	std::unique_ptr<gfx::pipeline> pipeline;
+
+	std::shared_ptr<gfx::descriptor_pool> pool;
+	std::vector<vk::DescriptorSet> sets;
+
+	// the [render_graph::on_recreate] count each set was last written at.
+	std::vector<uint64_t> written;
+};
+
 // initialize graphics context, device and swapchain
 // this is just a simple testing environment/playground for me, this is not
 // supposed to be used as a part of the library.
@@ -47,60 +74,116 @@ int main()
 
 	try
 	{
+		// the amount of frames in flight can be tuned per machine, without having to rebuild.
+		uint32_t frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT;
+
+		if (const char *frames = std::getenv("VX_FRAMES_IN_FLIGHT"))
+		{
+			frames_in_flight = static_cast<uint32_t>(std::strtoul(frames, nullptr, 10));
+		}
+
+		// records the CPU zones of startup and the first VX_TRACE_FRAMES frames, as Chrome trace_event JSON.
+		if (const char *frames = std::getenv("VX_TRACE_FRAMES"))
+		{
+			const char *path = std::getenv("VX_TRACE_FILE");
+			gfx::debug::capture_frames(static_cast<uint32_t>(std::strtoul(frames, nullptr, 10)), path ? path : "trace.json");
+		}
+
 		// create shared context object
-		auto context = std::make_shared<gfx::context>();
+		auto context = std::make_shared<gfx::context>(frames_in_flight);
 
 		// create shared device object
 		auto device = std::make_shared<gfx::device>(&context->instance, &context->surface);
 
+		// keep the VMA pools from fragmenting over long sessions, a bounded amount of moves per frame
+		device->get_defragmenter()->enabled = true;
+
 		// create shared swapchain object
 		auto swapchain = std::make_shared<gfx::swapchain>(device);
 
+		// mailbox paced with present_wait, use gfx::present_policy::throughput for uncapped benchmarks.
+		swapchain->policy = gfx::present_policy::low_latency;
+
 		// initialize swapchain before doing anything else with it
 		context->init_swap_chain(swapchain);
 
-		// add new render pass to swapchain by name "shadow"
-		swapchain->add_render_pass(
-			"shadow", gfx::start_render_pass(swapchain));
-
-		// get the render pass from the swapchain
-		auto render_pass = swapchain->render_passes.at("shadow");
-
 		// create shared commands object
-		auto commands = std::make_shared<gfx::commands>(swapchain, &context->surface);
+		auto commands = std::make_shared<gfx::commands>(swapchain, &context->surface, context->frames_in_flight);
 
 		// set device and commands for the context
 		context->device = device;
 		context->commands = commands;
 
+		// counts the vertices, primitives and fragments of every pipeline, logged once a second.
+		bool log_statistics = std::getenv("VX_PIPELINE_STATISTICS") != nullptr && commands->enable_statistics();
+
 		// create draw object
 		gfx::draw drawer(context);
 
+		/**
+		 * the frame is a render graph: the scene is drawn with a depth buffer, vignetted and copied to the swapchain.
+		 *
+		 * with VX_SHOW_DEPTH, the depth buffer is shown instead, which leaves nothing using the vignette pass, so it's
+		 * culled. otherwise the depth view is culled. either way, the attachment the last pass reads can share its
+		 * memory with one that's no longer used by then.
+		 */
+		gfx::render_graph graph(swapchain, commands);
+		bool show_depth = std::getenv("VX_SHOW_DEPTH") != nullptr;
+
+		gfx::graph_resource backbuffer = graph.import_swapchain();
+		gfx::graph_resource depth = graph.create_attachment("depth", vk::Format::eD32Sfloat);
+		gfx::graph_resource scene = graph.create_attachment("scene", vk::Format::eR8G8B8A8Unorm);
+		gfx::graph_resource vignetted = graph.create_attachment("vignetted", vk::Format::eR8G8B8A8Unorm);
+		gfx::graph_resource depth_view = graph.create_attachment("depth view", vk::Format::eR8G8B8A8Unorm);
+
+		// the scene is drawn from every hardware thread, so its pass is recorded into secondary command buffers.
+		gfx::graph_pass &scene_pass = graph.add_pass("scene");
+		scene_pass.write_color(scene, gfx::clear({ 0.0, 0.0, 0.0, 0.0 }).color);
+		scene_pass.write_depth(depth, vk::ClearDepthStencilValue { 1.0f, 0 });
+		scene_pass.record_secondary();
+
+		fullscreen_pass post_passes[] = {
+			{ scene, "vignette.frag.spv" },
+			{ depth, "depth.frag.spv" },
+			{ show_depth ? depth_view : vignetted, "blit.frag.spv" },
+		};
+
+		post_passes[0].pass = &graph.add_pass("vignette").read(scene).write_color(vignetted);
+		post_passes[1].pass = &graph.add_pass("depth view").read(depth).write_color(depth_view);
+		post_passes[2].pass = &graph.add_pass("present").read(post_passes[2].source).write_color(backbuffer);
+
+		// the views of the attachments change when they're recreated along with the swapchain.
+		uint64_t attachment_views = 0;
+		graph.on_recreate = [&]() { attachment_views++; };
+
+		graph.compile();
+
 		// create pipeline object with specified parameters
 		gfx::pipeline pipeline {
 			swapchain,
-			"shadow",
-			"build/triangle.vert.spv",
-			"build/triangle.frag.spv",
+			scene_pass.get_render_pass(),
+			std::string(SHADER_DIRECTORY) + "/triangle.vert.spv",
+			std::string(SHADER_DIRECTORY) + "/triangle.frag.spv",
 		};
 
-		vk::BufferUsageFlags flags = vk::BufferUsageFlagBits::eVertexBuffer
-			| vk::BufferUsageFlagBits::eTransferDst;
-		gfx::buffer<const gfx::vertex *> vertex_buffer(device, commands, vertices.data(), sizeof(gfx::vertex) * vertices.size(), flags, vma::memory_usage::GpuOnly);
-		// doesn't work for some reason. have to investigate this
-		// gfx::vec_buffer<gfx::vertex> vertex_buffer(device, commands, vertices, vk::BufferUsageFlagBits::eVertexBuffer, vma::memory_usage::GpuOnly);
+		pipeline.depth_stencil = vk::PipelineDepthStencilStateCreateInfo { {}, true, true, vk::CompareOp::eLess };
+
+		// all meshes are sub-allocated from the pages of the geometry arena, instead of owning a buffer each.
+		gfx::geometry_arena arena(device, commands, sizeof(gfx::vertex));
+		gfx::mesh_range mesh = arena.create_mesh(vertices, indices);
 
 		gfx::uniform_buffer_object object;
-		gfx::index_buffer<const uint16_t *> index_buffer(device, commands, indices.data(), sizeof(uint16_t) * indices.size(), vma::memory_usage::GpuOnly, vk::IndexType::eUint16);
-		gfx::uniform_buffer<gfx::uniform_buffer_object> uniform_buffer(device, commands, object, sizeof(gfx::uniform_buffer_object), vma::memory_usage::GpuOnly);
 
-		auto pool = std::make_shared<gfx::descriptor_pool>(device, vk::DescriptorType::eUniformBuffer);
+		// per-frame and per-draw uniforms are bump-allocated from a single ring, and bound with dynamic offsets.
+		gfx::uniform_ring uniforms(device, context->frames_in_flight);
+
+		auto pool = std::make_shared<gfx::descriptor_pool>(device, vk::DescriptorType::eUniformBufferDynamic, context->frames_in_flight);
 
 		gfx::uniform_layout layout {
 			device,
 			{
 				0,
-				vk::DescriptorType::eUniformBuffer,
+				vk::DescriptorType::eUniformBufferDynamic,
 				1,
 				vk::ShaderStageFlagBits::eVertex,
 				nullptr,
@@ -111,7 +194,8 @@ int main()
 			  }
 		};
 
-		gfx::descriptor_set<gfx::uniform_buffer_object> descriptor_set { pool, layout, uniform_buffer };
+		vk::DescriptorSet uniform_set = pool->create_descriptor_set(layout);
+		uniforms.write_descriptor(uniform_set, 0, sizeof(gfx::uniform_buffer_object));
 
 		// bind vertex buffer and attribute descriptions
 		pipeline.bind_vertex_buffer<gfx::vertex>(
@@ -120,11 +204,114 @@ int main()
 
 		pipeline.bind_uniform_layout(layout);
 
-		// initialize the pipeline object
-		pipeline.initialize();
+		gfx::uniform_layout sampler_layout {
+			device,
+			{
+				0,
+				vk::DescriptorType::eCombinedImageSampler,
+				1,
+				vk::ShaderStageFlagBits::eFragment,
+				nullptr,
+			  },
+			{
+				{},
+				0,
+			  }
+		};
+
+		// the attachments are all the same size, the depth buffer can't be filtered linearly on every device.
+		vk::Sampler sampler = device->get_logical_device().createSampler(vk::SamplerCreateInfo {
+			{},
+			vk::Filter::eNearest,
+			vk::Filter::eNearest,
+			vk::SamplerMipmapMode::eNearest,
+			vk::SamplerAddressMode::eClampToEdge,
+			vk::SamplerAddressMode::eClampToEdge,
+			vk::SamplerAddressMode::eClampToEdge,
+		});
+
+		std::vector<gfx::pipeline *> pipelines { &pipeline };
+
+		for (fullscreen_pass &post : post_passes)
+		{
+			// culled passes have no render pass, and are never executed.
+			if (!post.pass->is_active())
+			{
+				continue;
+			}
+
+			post.pipeline = std::make_unique<gfx::pipeline>(swapchain,
+				post.pass->get_render_pass(),
+				std::string(SHADER_DIRECTORY) + "/fullscreen.vert.spv",
+				std::string(SHADER_DIRECTORY) + "/" + post.frag_shader);
+
+			post.pipeline->bind_uniform_layout(sampler_layout);
+			pipelines.push_back(post.pipeline.get());
+
+			post.pool = std::make_shared<gfx::descriptor_pool>(device, vk::DescriptorType::eCombinedImageSampler, context->frames_in_flight);
+			post.sets = post.pool->create_descriptor_sets(sampler_layout);
+			post.written.assign(post.sets.size(), UINT64_MAX);
+
+			post.pass->execute([&, self = &post](vk::CommandBuffer *buffer) {
+				uint32_t frame = commands->current_frame;
+
+				// the frame's set was last used by the frame before it in the same slot, which has finished by now.
+				if (self->written[frame] != attachment_views)
+				{
+					vk::DescriptorImageInfo image { sampler, graph.get_view(self->source), vk::ImageLayout::eShaderReadOnlyOptimal };
+					vk::WriteDescriptorSet write { self->sets[frame], 0, 0, 1, vk::DescriptorType::eCombinedImageSampler, &image };
+
+					device->get_logical_device().updateDescriptorSets(write, nullptr);
+					self->written[frame] = attachment_views;
+				}
+
+				self->pipeline->bind<const uint16_t *>(buffer, {}, {}, { self->sets[frame] });
+				buffer->draw(3, 1, 0, 0);
+			});
+		}
+
+		// pipelines are compiled on the pool, while the main thread carries on setting up.
+		gfx::thread_pool workers;
+		std::vector<std::future<void>> pipelines_ready = gfx::build_pipelines(workers, pipelines);
+
+		// draws are recorded into secondary command buffers, spread over all hardware threads.
+		gfx::parallel_recorder recorder(device, commands);
+
+		for (auto &ready : pipelines_ready)
+		{
+			ready.get();
+		}
+
+		// recompiling a shader rebuilds the pipelines using it in the background, without restarting.
+		gfx::shader_watcher shaders(workers);
+
+		for (gfx::pipeline *watched : pipelines)
+		{
+			shaders.watch(watched);
+		}
+
+		uint32_t uniform_offset = 0;
+
+		scene_pass.execute([&](vk::CommandBuffer *buffer) {
+			recorder.record(buffer, scene_pass, 1, [&](vk::CommandBuffer *secondary, uint32_t first, uint32_t last) {
+				pipeline.bind(secondary, mesh, { uniform_set }, { uniform_offset });
+				auto statistics = pipeline.measure(secondary);
+
+				for (uint32_t i = first; i < last; i++)
+				{
+					mesh.draw(secondary);
+				}
+			});
+		});
 
 		uint32_t frame_time = 0.0;
 
+		// with VX_ALLOCATION_TEST, the loop runs for [allocation_test_frames] frames and fails on any allocation after warming up.
+		// that's long enough for a defragmentation to start, see [defragmenter::interval].
+		const uint64_t allocation_test_warmup = 100;
+		const uint64_t allocation_test_frames = 1000;
+		uint64_t frame_number = 0;
+
 		auto start_time = std::chrono::high_resolution_clock::now();
 		auto last_time = std::chrono::high_resolution_clock::now();
 
@@ -141,14 +328,56 @@ int main()
 
 			if (time_since_last >= 1.0)
 			{
-				glfwSetWindowTitle(context->window, std::to_string(frame_time).c_str());
+				// the frame rate, followed by the GPU time of every render pass and scope of the last frame read back.
+				std::string title = fmt::format("{} fps", frame_time);
+
+				for (const auto &timing : commands->profiler->get_results())
+				{
+					title += fmt::format(" | {}: {:.3f} ms", timing.name, timing.milliseconds);
+				}
+
+				glfwSetWindowTitle(context->window, title.c_str());
+
+				if (log_statistics)
+				{
+					for (const auto &counters : commands->statistics->get_results())
+					{
+						spdlog::info("{}: {} vertices, {} primitives ({} after clipping), {} vertex and {} fragment invocations",
+							counters.name,
+							counters.input_vertices,
+							counters.input_primitives,
+							counters.clipping_primitives,
+							counters.vertex_invocations,
+							counters.fragment_invocations);
+					}
+				}
 				frame_time = 0;
 				last_time = current_time;
 			}
 
+			int width, height;
+			glfwGetFramebufferSize(context->window, &width, &height);
+
+			// there's nothing to render to while minimized, sleep until the window is restored instead of spinning.
+			if (width == 0 || height == 0)
+			{
+				glfwWaitEvents();
+				continue;
+			}
+
+			uint64_t allocations_before = gfx::debug::allocation_count();
+
 			// begin drawing commands
 			drawer.begin();
 
+			// swap in pipelines whose optimized link has finished in the background.
+			for (gfx::pipeline *linked : pipelines)
+			{
+				linked->promote(commands->deletion_queue.get());
+			}
+
+			shaders.update(commands->deletion_queue.get());
+
 			// run commands within the draw object
 			drawer.run([&](vk::CommandBuffer *buffer, auto index) {
 				{
@@ -159,28 +388,44 @@ int main()
 					};
 
 					object.proj[1][1] *= -1;
-					uniform_buffer.map(object, commands->current_frame);
 				}
 
-				render_pass.begin(buffer, index, gfx::clear({ 0.0, 0.0, 0.0, 0.0 }));
-				pipeline.bind<const uint16_t *>(buffer,
-					{ vertex_buffer.get_buffer() },
-					{ index_buffer },
-					{ descriptor_set.sets[commands->current_frame] });
+				uniforms.begin_frame(commands->current_frame);
+				uniform_offset = uniforms.push(object);
 
-				buffer->drawIndexed(static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-				render_pass.end(buffer);
+				graph.execute(buffer, index);
 			});
 
+			frame_number++;
+
+			// once everything has been created and grown to its steady-state size, a frame shouldn't allocate at all.
+			if (gfx::debug::counting_allocations() && frame_number > allocation_test_warmup)
+			{
+				uint64_t allocations = gfx::debug::allocation_count() - allocations_before;
+
+				if (allocations != 0)
+				{
+					throw std::runtime_error(fmt::format("frame {} made {} heap allocations, expected none", frame_number, allocations));
+				}
+
+				if (frame_number == allocation_test_frames)
+				{
+					spdlog::info("no heap allocations in {} frames after warming up", allocation_test_frames - allocation_test_warmup);
+					glfwSetWindowShouldClose(context->window, GLFW_TRUE);
+				}
+			}
+
 			// poll for events
 			glfwPollEvents();
 		}
 
 		// wait for device to finish rendering
 		device->get_logical_device().waitIdle();
+		device->get_logical_device().destroySampler(sampler);
 	} catch (std::exception &e)
 	{
 		spdlog::error("unable to instantiate vuxol, {}", e.what());
+		return EXIT_FAILURE;
 	}
 
 	spdlog::info("program shutdown.");
@@ -0,0 +1,223 @@
+#include <config.h>
+#include <debug/zones.h>
+#include <parallel.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace gfx
+{
+	parallel_recorder::parallel_recorder(std::shared_ptr<gfx::device> device, std::shared_ptr<gfx::commands> commands, uint32_t threads)
+		: device { device }
+		, commands { commands }
+		, workers(std::max(threads, 1u))
+	{
+		vk::CommandPoolCreateInfo pool_info {
+			vk::CommandPoolCreateFlagBits::eTransient,
+			device->get_queue_families().graphics_family.value(),
+		};
+
+		for (auto &worker : workers)
+		{
+			for (uint32_t i = 0; i < commands->get_frames_in_flight(); i++)
+			{
+				worker.pools.push_back(frame_pool { device->get_logical_device().createCommandPool(pool_info) });
+			}
+		}
+
+		// the pools have to exist before any of the threads can touch them.
+		for (uint32_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].thread = std::thread(&parallel_recorder::run, this, i);
+		}
+
+		this->secondaries.reserve(workers.size());
+
+		spdlog::info("started {} recording threads", workers.size());
+	}
+
+	parallel_recorder::~parallel_recorder()
+	{
+		spdlog::info("cleaning up gfx::parallel_recorder");
+
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+
+		job_ready.notify_all();
+
+		for (auto &worker : workers)
+		{
+			worker.thread.join();
+		}
+
+		// the secondary command buffers may still be referenced by frames in flight.
+		device->get_logical_device().waitIdle();
+
+		for (auto &worker : workers)
+		{
+			for (auto &pool : worker.pools)
+			{
+				device->get_logical_device().destroyCommandPool(pool.pool);
+			}
+		}
+
+		spdlog::info("... done!");
+	}
+
+	void parallel_recorder::record(vk::CommandBuffer *primary, gfx::render_pass &pass, uint32_t image_index, uint32_t count, record_callback callback)
+	{
+		this->record(primary, vk::CommandBufferInheritanceInfo { pass.pass, 0, pass.framebuffers[image_index] }, pass.get_extent(), count, callback);
+	}
+
+	void parallel_recorder::record(vk::CommandBuffer *primary, const gfx::graph_pass &pass, uint32_t count, record_callback callback)
+	{
+		if (!pass.get_framebuffer())
+		{
+			throw std::runtime_error("render graph pass '" + pass.get_name() + "' can only be recorded while it's executed!");
+		}
+
+		this->record(primary, vk::CommandBufferInheritanceInfo { pass.get_render_pass(), 0, pass.get_framebuffer() }, pass.get_extent(), count, callback);
+	}
+
+	void parallel_recorder::record(vk::CommandBuffer *primary, vk::CommandBufferInheritanceInfo inheritance, vk::Extent2D extent, uint32_t count, record_callback callback)
+	{
+		VX_ZONE("parallel_recorder::record");
+
+		uint32_t slice = (count + get_thread_count() - 1) / get_thread_count();
+
+		for (uint32_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].first = std::min(i * slice, count);
+			workers[i].last = std::min(workers[i].first + slice, count);
+			workers[i].recorded = nullptr;
+		}
+
+		{
+			std::lock_guard lock(mutex);
+
+			this->callback = callback;
+			this->inheritance = inheritance;
+			this->extent = extent;
+			this->error = nullptr;
+			this->remaining = get_thread_count();
+			this->generation++;
+		}
+
+		job_ready.notify_all();
+
+		std::unique_lock lock(mutex);
+		job_done.wait(lock, [&]() { return remaining == 0; });
+
+		this->callback.reset();
+
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+
+		secondaries.clear();
+
+		// executing them in worker order keeps the draw order the same as it would be on a single thread.
+		for (auto &worker : workers)
+		{
+			if (worker.recorded)
+			{
+				secondaries.push_back(worker.recorded);
+			}
+		}
+
+		if (!secondaries.empty())
+		{
+			primary->executeCommands(secondaries);
+		}
+	}
+
+	void parallel_recorder::run(uint32_t index)
+	{
+		worker &self = workers[index];
+		uint64_t seen = 0;
+
+		while (true)
+		{
+			{
+				std::unique_lock lock(mutex);
+				job_ready.wait(lock, [&]() { return stopping || generation != seen; });
+
+				if (stopping)
+				{
+					return;
+				}
+
+				seen = generation;
+			}
+
+			try
+			{
+				this->record_slice(self);
+			} catch (...)
+			{
+				std::lock_guard lock(mutex);
+				error = std::current_exception();
+			}
+
+			{
+				std::lock_guard lock(mutex);
+				remaining--;
+			}
+
+			job_done.notify_one();
+		}
+	}
+
+	void parallel_recorder::record_slice(gfx::parallel_recorder::worker &worker)
+	{
+		VX_ZONE("parallel_recorder::record_slice");
+
+		if (worker.first == worker.last)
+		{
+			return;
+		}
+
+		frame_pool &pool = worker.pools[commands->current_frame];
+
+		// the frame slot has been waited on by now, so everything recorded into this pool the last time around is done.
+		if (pool.frame != commands->frame_count)
+		{
+			device->get_logical_device().resetCommandPool(pool.pool);
+
+			pool.used = 0;
+			pool.frame = commands->frame_count;
+		}
+
+		vk::CommandBuffer buffer = this->next_buffer(pool);
+
+		buffer.begin(vk::CommandBufferBeginInfo {
+			vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+			&inheritance,
+		});
+
+		// dynamic state isn't inherited from the primary command buffer.
+		buffer.setViewport(0, vk::Viewport { 0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f });
+		buffer.setScissor(0, vk::Rect2D { { 0, 0 }, extent });
+
+		(*callback)(&buffer, worker.first, worker.last);
+
+		buffer.end();
+		worker.recorded = buffer;
+	}
+
+	vk::CommandBuffer parallel_recorder::next_buffer(gfx::parallel_recorder::frame_pool &pool)
+	{
+		if (pool.used == pool.buffers.size())
+		{
+			pool.buffers.push_back(device->get_logical_device().allocateCommandBuffers(
+				vk::CommandBufferAllocateInfo(
+					pool.pool,
+					vk::CommandBufferLevel::eSecondary,
+					1))[0]);
+		}
+
+		return pool.buffers[pool.used++];
+	}
+}
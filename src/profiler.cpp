@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cstring>
+#include <profiler.h>
+#include <spdlog/spdlog.h>
+
+namespace gfx
+{
+	gpu_profiler::gpu_profiler(std::shared_ptr<gfx::device> device, uint32_t frames_in_flight, uint32_t max_scopes)
+		: device { device }
+		, max_scopes { max_scopes }
+		, frame_scopes(frames_in_flight)
+	{
+		vk::PhysicalDevice physical_device = device->get_physical_device();
+
+		uint32_t graphics_family = device->get_queue_families().graphics_family.value();
+		uint32_t valid_bits = physical_device.getQueueFamilyProperties()[graphics_family].timestampValidBits;
+
+		if (valid_bits == 0)
+		{
+			spdlog::warn("graphics queue doesn't support timestamps, GPU profiling is disabled");
+			return;
+		}
+
+		this->period = physical_device.getProperties().limits.timestampPeriod;
+		this->valid_mask = valid_bits == 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+		vk::QueryPoolCreateInfo pool_info { {}, vk::QueryType::eTimestamp, frames_in_flight * max_scopes * 2 };
+		this->pool = device->get_logical_device().createQueryPool(pool_info);
+		this->enabled = true;
+
+		for (auto &scopes : frame_scopes)
+		{
+			scopes.reserve(max_scopes);
+		}
+
+		this->timestamps.resize(max_scopes * 2);
+		this->results.reserve(max_scopes);
+	}
+
+	gpu_profiler::~gpu_profiler()
+	{
+		if (enabled)
+		{
+			device->get_logical_device().destroyQueryPool(pool);
+		}
+	}
+
+	void gpu_profiler::begin_frame(vk::CommandBuffer command_buffer, uint32_t frame)
+	{
+		if (!enabled)
+		{
+			return;
+		}
+
+		this->read_back(frame);
+		this->current_frame = frame;
+
+		frame_scopes[frame].clear();
+		command_buffer.resetQueryPool(pool, frame * max_scopes * 2, max_scopes * 2);
+	}
+
+	uint32_t gpu_profiler::begin_scope(vk::CommandBuffer command_buffer, const char *name)
+	{
+		auto &scopes = frame_scopes[current_frame];
+
+		if (!enabled || scopes.size() == max_scopes)
+		{
+			return invalid_scope;
+		}
+
+		uint32_t query = (current_frame * max_scopes + static_cast<uint32_t>(scopes.size())) * 2;
+		scopes.push_back(scope { name, query });
+
+		command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, pool, query);
+
+		return query;
+	}
+
+	void gpu_profiler::end_scope(vk::CommandBuffer command_buffer, uint32_t scope)
+	{
+		if (scope == invalid_scope)
+		{
+			return;
+		}
+
+		command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, pool, scope + 1);
+	}
+
+	double gpu_profiler::get_milliseconds(const char *name) const
+	{
+		for (const auto &timing : results)
+		{
+			if (strcmp(timing.name, name) == 0)
+			{
+				return timing.milliseconds;
+			}
+		}
+
+		return 0.0;
+	}
+
+	void gpu_profiler::read_back(uint32_t frame)
+	{
+		auto &scopes = frame_scopes[frame];
+
+		if (scopes.empty())
+		{
+			return;
+		}
+
+		uint32_t count = static_cast<uint32_t>(scopes.size()) * 2;
+
+		// the frame has finished executing by now, so this won't wait. if a scope was never ended, we skip the frame.
+		vk::Result result = device->get_logical_device().getQueryPoolResults(
+			pool,
+			frame * max_scopes * 2,
+			count,
+			count * sizeof(uint64_t),
+			timestamps.data(),
+			sizeof(uint64_t),
+			vk::QueryResultFlagBits::e64);
+
+		if (result != vk::Result::eSuccess)
+		{
+			return;
+		}
+
+		results.clear();
+
+		for (const auto &scope : scopes)
+		{
+			uint32_t index = scope.query - frame * max_scopes * 2;
+			uint64_t ticks = (timestamps[index + 1] - timestamps[index]) & valid_mask;
+			double milliseconds = ticks * period / 1'000'000.0;
+
+			// scopes with the same name (like a pass that's begun more than once) are added up.
+			auto it = std::find_if(results.begin(), results.end(), [&](const gfx::gpu_timing &timing) {
+				return strcmp(timing.name, scope.name) == 0;
+			});
+
+			if (it != results.end())
+			{
+				it->milliseconds += milliseconds;
+			}
+			else
+			{
+				results.push_back(gfx::gpu_timing { scope.name, milliseconds });
+			}
+		}
+	}
+}
@@ -1,6 +1,7 @@
 #include "commands.h"
 #include "device.h"
 #include <config.h>
+#include <debug/zones.h>
 #include <render.h>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
@@ -25,64 +26,180 @@ namespace gfx
 
 	void draw::begin()
 	{
+		// zones recorded from here on belong to the new frame.
+		gfx::debug::mark_frame();
+		VX_ZONE("draw::begin");
+
+		// sleep until the display is ready for another frame, before any of its input is sampled.
+		swapchain->wait_for_present();
+
 		commands->begin(commands->command_buffers[commands->current_frame]);
+		device->set_frame_index(frame_count++);
+	}
+
+	void draw::wait_for(gfx::upload_token token)
+	{
+		this->pending_uploads.push_back(std::move(token));
 	}
 
 	void draw::run(
-		std::function<void(vk::CommandBuffer *buffer, uint32_t image_index)> draw)
+		gfx::function_ref<void(vk::CommandBuffer *buffer, uint32_t image_index)> draw)
 	{
-		vk::ResultValue<uint32_t> image_index = device->get_logical_device().acquireNextImageKHR(
-			swapchain->chain,
-			UINT64_MAX,
-			commands->image_available_semaphores[commands->current_frame] // we want the current frame's semaphore, because we need the image index.
-		);
+		VX_ZONE("draw::run");
+
+		// the old swapchain is retired through the deletion queue, so recreating it never has to wait for the device.
+		if (swapchain->out_of_date && !swapchain->recreate(commands->deletion_queue.get()))
+		{
+			// the window is minimized, there's nothing to render to.
+			commands->skip_frame();
+			return;
+		}
+
+		vk::ResultValue<uint32_t> image_index { vk::Result::eSuccess, 0 };
+
+		try
+		{
+			VX_ZONE("draw::acquire");
+			image_index = device->get_logical_device().acquireNextImageKHR(
+				swapchain->chain,
+				UINT64_MAX,
+				commands->image_available_semaphores[commands->current_frame] // we want the current frame's semaphore, because we need the image index.
+			);
+		} catch (vk::OutOfDateKHRError &)
+		{
+			// the semaphore isn't signaled if no image was acquired, so we can just try again next frame.
+			swapchain->out_of_date = true;
+			commands->skip_frame();
+			return;
+		}
+
+		// a suboptimal swapchain can still be presented to, so finish this frame and recreate it before the next one.
+		if (image_index.result == vk::Result::eSuboptimalKHR)
+		{
+			swapchain->out_of_date = true;
+		}
+
+		vk::CommandBuffer &command_buffer = commands->command_buffers[commands->current_frame];
+
+		wait_semaphores.clear();
+		wait_stages.clear();
+		wait_values.clear();
+
+		wait_semaphores.push_back(commands->image_available_semaphores[commands->current_frame]);
+		wait_stages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+		wait_values.push_back(0);
+
+		// uploads only have to be finished by the time their data is read, not before the whole frame starts.
+		for (auto &token : pending_uploads)
+		{
+			// transfers are included, so the defragmentation copies recorded below are ordered after the upload.
+			vk::PipelineStageFlags upload_stages = vk::PipelineStageFlagBits::eTransfer
+				| vk::PipelineStageFlagBits::eVertexInput
+				| vk::PipelineStageFlagBits::eVertexShader;
+
+			wait_semaphores.push_back(token.point.semaphore);
+			wait_stages.push_back(upload_stages);
+			wait_values.push_back(token.point.value);
+
+			if (!token.acquire_barriers.empty())
+			{
+				command_buffer.pipelineBarrier(upload_stages, upload_stages, {}, nullptr, token.acquire_barriers, nullptr);
+			}
+
+			// the buffers of the upload are ours from here on, so they can be moved again.
+			device->get_defragmenter()->release(token.point);
+		}
+
+		pending_uploads.clear();
+
+		// move a bounded amount of allocations, before anything in this frame reads from them.
+		device->get_defragmenter()->step(command_buffer, commands->current_frame);
 
 		// we can call the draw() callback here, this will call of the user-implemented graphics calls.
-		draw(&commands->command_buffers[commands->current_frame], image_index.value);
+		{
+			VX_ZONE("draw::record");
+			draw(&command_buffer, image_index.value);
+		}
 
 		// we have to end the command buffer before we can do anything else, we can do this here,
 		// as long as we do it before we submit the info the graphics card.
 		// it makes sense to do it here, as the lines under here are just declaratioss.
-		commands->command_buffers[commands->current_frame].end();
+		command_buffer.end();
 
 		spdlog::debug("just passed draw()");
 
 		// we can't use commands->wait_and_submit() here, because we also have to signal the semaphores!
 		// however, we don't always want to signal them, that's why the wait_and_submit() function doesn't do this.
-		vk::Semaphore wait_semaphores[] = { commands->image_available_semaphores[commands->current_frame] };
-		vk::Semaphore signal_semaphores[] = { commands->render_finished_semaphores[commands->current_frame] };
+		// the binary semaphore is for the presentation engine, the timeline value for everything else that waits on this frame.
+		gfx::timeline_point frame_point = commands->get_frame_point();
 
-		vk::PipelineStageFlags wait_stages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
+		vk::Semaphore signal_semaphores[] = { commands->render_finished_semaphores[commands->current_frame], frame_point.semaphore };
+		uint64_t signal_values[] = { 0, frame_point.value };
+
+		vk::TimelineSemaphoreSubmitInfo timeline_info {
+			static_cast<uint32_t>(wait_values.size()),
+			wait_values.data(),
+			sizeof(signal_values) / sizeof(uint64_t),
+			signal_values,
+		};
 
 		vk::SubmitInfo submit_info {
-			sizeof(wait_semaphores) / sizeof(vk::Semaphore),
-			wait_semaphores,
-			wait_stages,
+			static_cast<uint32_t>(wait_semaphores.size()),
+			wait_semaphores.data(),
+			wait_stages.data(),
 			1,
-			&commands->command_buffers[commands->current_frame],
+			&command_buffer,
 			sizeof(signal_semaphores) / sizeof(vk::Semaphore),
 			signal_semaphores,
+			&timeline_info,
 		};
 
 		spdlog::debug("attempting to submit to device->graphics_queue");
-		device->graphics_queue.submit(submit_info, commands->in_flight_fences[commands->current_frame]);
+		{
+			VX_ZONE("draw::submit");
+			device->graphics_queue.submit(submit_info);
+		}
+
+		// staging regions the frame's copies read from can be waited on from now on.
+		device->get_staging_ring()->mark_submitted(frame_point);
 		spdlog::debug("submmited to device->graphics_queue");
 
 		vk::SwapchainKHR swap_chains[] = { swapchain->chain };
+		// presentation can only wait on binary semaphores, which is only the first one.
 		vk::PresentInfoKHR present_info {
-			sizeof(wait_semaphores) / sizeof(vk::Semaphore),
+			1,
 			signal_semaphores,
 			sizeof(swap_chains) / sizeof(vk::SwapchainKHR),
 			swap_chains,
 			&image_index.value
 		};
 
+		// tag the present with an id, so [swapchain::wait_for_present] can wait for it to be displayed.
+		uint64_t present_id = swapchain->present_id + 1;
+		vk::PresentIdKHR present_id_info { 1, &present_id };
+
+		if (device->supports_present_wait())
+		{
+			present_info.pNext = &present_id_info;
+			swapchain->present_id = present_id;
+		}
+
 		spdlog::debug("trying to present to the surface");
-		if (device->present_queue.presentKHR(present_info) != vk::Result::eSuccess)
+
+		try
+		{
+			VX_ZONE("draw::present");
+
+			if (device->present_queue.presentKHR(present_info) == vk::Result::eSuboptimalKHR)
+			{
+				swapchain->out_of_date = true;
+			}
+		} catch (vk::OutOfDateKHRError &)
 		{
-			throw std::runtime_error("unable to present info!");
+			// the semaphore wait of a rejected present still happens, so the frame can be finished as usual.
+			swapchain->out_of_date = true;
 		}
 
-		commands->current_frame = (commands->current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+		commands->current_frame = (commands->current_frame + 1) % commands->get_frames_in_flight();
 	}
 }
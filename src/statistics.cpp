@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cstring>
+#include <statistics.h>
+
+namespace gfx
+{
+	statistics_scope::statistics_scope(gfx::pipeline_statistics *statistics, vk::CommandBuffer command_buffer, const char *name)
+		: statistics { statistics }
+		, command_buffer { command_buffer }
+		, query { statistics ? statistics->begin(command_buffer, name) : gfx::pipeline_statistics::invalid_scope }
+	{
+	}
+
+	statistics_scope::~statistics_scope()
+	{
+		if (statistics)
+		{
+			statistics->end(command_buffer, query);
+		}
+	}
+
+	pipeline_statistics::pipeline_statistics(std::shared_ptr<gfx::device> device, uint32_t frames_in_flight, uint32_t max_scopes)
+		: device { device }
+		, max_scopes { max_scopes }
+		, frame_used(frames_in_flight, 0)
+		, names(frames_in_flight * max_scopes, nullptr)
+	{
+		if (!device->supports_pipeline_statistics())
+		{
+			throw std::runtime_error("pipeline statistics need the pipelineStatisticsQuery feature!");
+		}
+
+		vk::QueryPoolCreateInfo pool_info { {}, vk::QueryType::ePipelineStatistics, frames_in_flight * max_scopes, statistic_flags };
+		this->pool = device->get_logical_device().createQueryPool(pool_info);
+
+		this->counters.resize(max_scopes * counter_count);
+		this->results.reserve(max_scopes);
+	}
+
+	pipeline_statistics::~pipeline_statistics()
+	{
+		device->get_logical_device().destroyQueryPool(pool);
+	}
+
+	void pipeline_statistics::begin_frame(vk::CommandBuffer command_buffer, uint32_t frame)
+	{
+		// the previous frame is done recording, so the amount of scopes it used can be stored for reading it back later.
+		frame_used[current_frame] = std::min(used.exchange(0), max_scopes);
+
+		this->read_back(frame);
+		this->current_frame = frame;
+
+		frame_used[frame] = 0;
+		command_buffer.resetQueryPool(pool, frame * max_scopes, max_scopes);
+	}
+
+	uint32_t pipeline_statistics::begin(vk::CommandBuffer command_buffer, const char *name)
+	{
+		uint32_t index = used.fetch_add(1, std::memory_order_relaxed);
+
+		if (index >= max_scopes)
+		{
+			return invalid_scope;
+		}
+
+		uint32_t query = current_frame * max_scopes + index;
+		names[query] = name;
+
+		command_buffer.beginQuery(pool, query, {});
+
+		return query;
+	}
+
+	void pipeline_statistics::end(vk::CommandBuffer command_buffer, uint32_t scope)
+	{
+		if (scope == invalid_scope)
+		{
+			return;
+		}
+
+		command_buffer.endQuery(pool, scope);
+	}
+
+	void pipeline_statistics::read_back(uint32_t frame)
+	{
+		uint32_t count = frame_used[frame];
+
+		if (count == 0)
+		{
+			return;
+		}
+
+		// the frame has finished executing by now, so this won't wait.
+		vk::Result result = device->get_logical_device().getQueryPoolResults(
+			pool,
+			frame * max_scopes,
+			count,
+			count * counter_count * sizeof(uint64_t),
+			counters.data(),
+			counter_count * sizeof(uint64_t),
+			vk::QueryResultFlagBits::e64);
+
+		if (result != vk::Result::eSuccess)
+		{
+			return;
+		}
+
+		results.clear();
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const char *name = names[frame * max_scopes + i];
+			const uint64_t *values = &counters[i * counter_count];
+
+			auto it = std::find_if(results.begin(), results.end(), [&](const gfx::pipeline_counters &counters) {
+				return strcmp(counters.name, name) == 0;
+			});
+
+			if (it == results.end())
+			{
+				it = results.insert(results.end(), gfx::pipeline_counters { name });
+			}
+
+			// every scope of the same pipeline (from every thread that drew with it) is added up.
+			it->input_vertices += values[0];
+			it->input_primitives += values[1];
+			it->vertex_invocations += values[2];
+			it->clipping_invocations += values[3];
+			it->clipping_primitives += values[4];
+			it->fragment_invocations += values[5];
+		}
+	}
+}
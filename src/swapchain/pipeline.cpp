@@ -1,5 +1,7 @@
 #include "vertex.h"
 #include <buffer/buffer.h>
+#include <chrono>
+#include <debug/zones.h>
 #include <fstream>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
@@ -36,9 +38,18 @@ namespace gfx
 		const std::string &parent_pass,
 		const std::string vert_shader_name,
 		const std::string frag_shader_name)
+		: pipeline(swapchain, swapchain->render_passes.at(parent_pass).pass, vert_shader_name, frag_shader_name)
+	{
+	}
+
+	pipeline::pipeline(std::shared_ptr<gfx::swapchain> swapchain,
+		vk::RenderPass render_pass,
+		const std::string vert_shader_name,
+		const std::string frag_shader_name)
 		: swapchain { swapchain }
 		, device { swapchain->device }
-		, pass { &swapchain->render_passes.at(parent_pass) }
+		, render_pass { render_pass }
+		, name { vert_shader_name + " + " + frag_shader_name }
 		, vert_shader_name { vert_shader_name }
 		, frag_shader_name { frag_shader_name }
 	{
@@ -47,10 +58,81 @@ namespace gfx
 	void pipeline::cleanup()
 	{
 		spdlog::info("cleaning up gfx::pipeline");
-		device->get_logical_device().destroyPipeline(vk_pipeline);
+		this->release(nullptr);
 		spdlog::info("... done!");
 	}
 
+	void pipeline::release(gfx::deletion_queue *deletion_queue)
+	{
+		gfx::pipeline_registry *registry = device->get_pipeline_registry();
+
+		// the optimized link may still be running, and it uses the libraries.
+		if (optimized.valid())
+		{
+			optimized.wait();
+		}
+
+		// libraries can't be bound, so nothing on the GPU can be using them.
+		this->destroy_libraries();
+
+		if (fast_linked && deletion_queue)
+		{
+			deletion_queue->destroy(fast_linked);
+		}
+		else
+		{
+			device->get_logical_device().destroyPipeline(fast_linked);
+		}
+
+		if (shared.valid())
+		{
+			registry->release(state, deletion_queue);
+		}
+
+		if (pipeline_layout)
+		{
+			registry->release_layout(pipeline_layout, deletion_queue);
+		}
+
+		this->fast_linked = nullptr;
+		this->vk_pipeline = nullptr;
+		this->pipeline_layout = nullptr;
+		this->shared = {};
+	}
+
+	std::unique_ptr<gfx::pipeline> pipeline::create_replacement() const
+	{
+		auto replacement = std::make_unique<gfx::pipeline>(swapchain, render_pass, vert_shader_name, frag_shader_name);
+
+		replacement->name = name;
+		replacement->depth_stencil = depth_stencil;
+		replacement->dynamic_states = dynamic_states;
+		replacement->binding_descriptions = binding_descriptions;
+		replacement->attribute_descriptions = attribute_descriptions;
+		replacement->layouts = layouts;
+
+		return replacement;
+	}
+
+	bool pipeline::replace_with(gfx::pipeline &replacement, gfx::deletion_queue *deletion_queue)
+	{
+		// the optimized link still refers to this pipeline's libraries, the replacement has to wait for it.
+		if (optimized.valid() || !replacement.vk_pipeline)
+		{
+			return false;
+		}
+
+		std::swap(vk_pipeline, replacement.vk_pipeline);
+		std::swap(pipeline_layout, replacement.pipeline_layout);
+		std::swap(fast_linked, replacement.fast_linked);
+		std::swap(state, replacement.state);
+		std::swap(shared, replacement.shared);
+
+		// frames in flight may still be using the old pipeline.
+		replacement.release(deletion_queue);
+		return true;
+	}
+
 	vk::ShaderModule pipeline::create_shader_module(const std::vector<char> &code)
 	{
 		vk::ShaderModuleCreateInfo create_info({}, code.size(), reinterpret_cast<const uint32_t *>(code.data()));
@@ -64,6 +146,183 @@ namespace gfx
 		this->create_graphics_pipeline();
 	}
 
+	void pipeline::create_from_libraries(const vk::GraphicsPipelineCreateInfo &info,
+		const vk::PipelineShaderStageCreateInfo &vertex_stage,
+		const vk::PipelineShaderStageCreateInfo &fragment_stage,
+		std::shared_ptr<std::promise<vk::Pipeline>> create)
+	{
+		vk::Device logical_device = device->get_logical_device();
+
+		// creates the part of the pipeline selected by [part], [library_info] only has to contain the state of that part.
+		auto create_library = [&](vk::GraphicsPipelineLibraryFlagsEXT part, vk::GraphicsPipelineCreateInfo library_info) {
+			vk::GraphicsPipelineLibraryCreateInfoEXT part_info { part };
+
+			library_info.pNext = &part_info;
+			library_info.flags = vk::PipelineCreateFlagBits::eLibraryKHR | vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT;
+
+			vk::Result result;
+			vk::Pipeline library;
+
+			std::tie(result, library) = logical_device.createGraphicsPipeline(device->get_pipeline_cache(), library_info);
+
+			if (result != vk::Result::eSuccess)
+			{
+				throw std::runtime_error("unable to make pipeline library");
+			}
+
+			this->libraries.push_back(library);
+		};
+
+		vk::GraphicsPipelineCreateInfo vertex_input {};
+		vertex_input.pVertexInputState = info.pVertexInputState;
+		vertex_input.pInputAssemblyState = info.pInputAssemblyState;
+		vertex_input.pDynamicState = info.pDynamicState;
+
+		vk::GraphicsPipelineCreateInfo pre_rasterization {};
+		pre_rasterization.stageCount = 1;
+		pre_rasterization.pStages = &vertex_stage;
+		pre_rasterization.pViewportState = info.pViewportState;
+		pre_rasterization.pRasterizationState = info.pRasterizationState;
+		pre_rasterization.pDynamicState = info.pDynamicState;
+		pre_rasterization.layout = info.layout;
+		pre_rasterization.renderPass = info.renderPass;
+		pre_rasterization.subpass = info.subpass;
+
+		vk::GraphicsPipelineCreateInfo fragment_shader {};
+		fragment_shader.stageCount = 1;
+		fragment_shader.pStages = &fragment_stage;
+		fragment_shader.pMultisampleState = info.pMultisampleState;
+		fragment_shader.pDepthStencilState = info.pDepthStencilState;
+		fragment_shader.pDynamicState = info.pDynamicState;
+		fragment_shader.layout = info.layout;
+		fragment_shader.renderPass = info.renderPass;
+		fragment_shader.subpass = info.subpass;
+
+		vk::GraphicsPipelineCreateInfo fragment_output {};
+		fragment_output.pMultisampleState = info.pMultisampleState;
+		fragment_output.pColorBlendState = info.pColorBlendState;
+		fragment_output.pDynamicState = info.pDynamicState;
+		fragment_output.renderPass = info.renderPass;
+		fragment_output.subpass = info.subpass;
+
+		create_library(vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface, vertex_input);
+		create_library(vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders, pre_rasterization);
+		create_library(vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader, fragment_shader);
+		create_library(vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface, fragment_output);
+
+		if (!link_in_background)
+		{
+			this->vk_pipeline = this->link_libraries(vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT);
+			this->destroy_libraries();
+
+			create->set_value(vk_pipeline);
+			return;
+		}
+
+		// a fast link is cheap enough to do on demand, the optimized pipeline replaces it once it's done, see [promote].
+		// only the optimized one is shared through the registry, the fast-linked one belongs to this pipeline.
+		this->fast_linked = this->link_libraries({});
+		this->vk_pipeline = fast_linked;
+
+		// pipelines sharing this one's state wait for the optimized link, if it was queued on the pool they're waiting on
+		// it could never run. so it gets a thread of its own.
+		this->optimized = std::async(std::launch::async, [this, create]() {
+			VX_ZONE("pipeline::link_optimized");
+
+			try
+			{
+				vk::Pipeline linked = this->link_libraries(vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT);
+				this->destroy_libraries();
+
+				create->set_value(linked);
+			} catch (...)
+			{
+				create->set_exception(std::current_exception());
+				throw;
+			}
+		});
+	}
+
+	vk::Pipeline pipeline::link_libraries(vk::PipelineCreateFlags flags)
+	{
+		vk::PipelineLibraryCreateInfoKHR library_info { static_cast<uint32_t>(libraries.size()), libraries.data() };
+
+		vk::GraphicsPipelineCreateInfo link_info {};
+		link_info.pNext = &library_info;
+		link_info.flags = flags;
+		link_info.layout = pipeline_layout;
+
+		vk::Result result;
+		vk::Pipeline linked;
+
+		std::tie(result, linked) = device->get_logical_device().createGraphicsPipeline(device->get_pipeline_cache(), link_info);
+
+		if (result != vk::Result::eSuccess)
+		{
+			throw std::runtime_error("unable to link pipeline");
+		}
+
+		return linked;
+	}
+
+	void pipeline::destroy_libraries()
+	{
+		for (vk::Pipeline library : libraries)
+		{
+			device->get_logical_device().destroyPipeline(library);
+		}
+
+		this->libraries.clear();
+	}
+
+	bool pipeline::promote(gfx::deletion_queue *deletion_queue)
+	{
+		if (!optimized.valid() || optimized.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			return false;
+		}
+
+		try
+		{
+			optimized.get();
+		} catch (const std::exception &error)
+		{
+			spdlog::warn("optimized link of pipeline '{}' failed, keeping the fast-linked one: {}", name, error.what());
+			return false;
+		}
+
+		// frames in flight may still be using the fast-linked pipeline.
+		deletion_queue->destroy(fast_linked);
+
+		this->fast_linked = nullptr;
+		this->vk_pipeline = shared.get();
+
+		spdlog::info("promoted pipeline '{}' to its optimized link", name);
+		return true;
+	}
+
+	std::future<void> pipeline::initialize_async(gfx::thread_pool &pool)
+	{
+		// pipelines built in the background can be fast-linked, and optimized in the background as well.
+		this->link_in_background = true;
+
+		// pipeline creation is thread-safe, including the shared pipeline cache, so there's nothing to lock here.
+		return pool.submit([this]() { this->create_graphics_pipeline(); });
+	}
+
+	std::vector<std::future<void>> build_pipelines(gfx::thread_pool &pool, const std::vector<gfx::pipeline *> &pipelines)
+	{
+		std::vector<std::future<void>> futures;
+		futures.reserve(pipelines.size());
+
+		for (gfx::pipeline *pipeline : pipelines)
+		{
+			futures.push_back(pipeline->initialize_async(pool));
+		}
+
+		return futures;
+	}
+
 	void pipeline::bind_uniform_layout(gfx::uniform_layout layout)
 	{
 		this->layouts.push_back(layout.layout);
@@ -85,7 +344,8 @@ namespace gfx
 		vk::ArrayProxy<vk::Buffer> buffers,
 		vk::ArrayProxy<std::reference_wrapper<gfx::index_buffer<T>>> index_buffers,
 		vk::ArrayProxy<vk::DescriptorSet> descriptor_sets,
-		vk::ArrayProxy<const vk::DeviceSize> const &offsets)
+		vk::ArrayProxy<const vk::DeviceSize> const &offsets,
+		vk::ArrayProxy<const uint32_t> const &dynamic_offsets)
 	{
 		if (!this->attribute_descriptions.empty() && buffers.empty())
 		{
@@ -110,35 +370,41 @@ namespace gfx
 			0,
 			static_cast<uint32_t>(descriptor_sets.size()),
 			descriptor_sets.data(),
+			static_cast<uint32_t>(dynamic_offsets.size()),
+			dynamic_offsets.data());
+	}
+
+	void pipeline::bind(vk::CommandBuffer *buffer,
+		const gfx::mesh_range &mesh,
+		vk::ArrayProxy<vk::DescriptorSet> descriptor_sets,
+		vk::ArrayProxy<const uint32_t> const &dynamic_offsets)
+	{
+		buffer->bindPipeline(vk::PipelineBindPoint::eGraphics, this->vk_pipeline);
+
+		// the vertex and index offsets are applied per draw through vertexOffset/firstIndex, so the pages are bound at 0.
+		buffer->bindVertexBuffers(0, mesh.vertices.buffer, { 0 });
+		buffer->bindIndexBuffer(mesh.indices.buffer, 0, mesh.index_type);
+
+		buffer->bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+			pipeline_layout,
 			0,
-			nullptr);
+			static_cast<uint32_t>(descriptor_sets.size()),
+			descriptor_sets.data(),
+			static_cast<uint32_t>(dynamic_offsets.size()),
+			dynamic_offsets.data());
 	}
 
-	template void pipeline::bind<const uint32_t *>(vk::CommandBuffer *buffer, vk::ArrayProxy<vk::Buffer> buffers, vk::ArrayProxy<std::reference_wrapper<gfx::index_buffer<const uint32_t *>>> index_buffers, vk::ArrayProxy<vk::DescriptorSet> descriptor_sets, vk::ArrayProxy<const vk::DeviceSize> const &offsets);
-	template void pipeline::bind<const uint16_t *>(vk::CommandBuffer *buffer, vk::ArrayProxy<vk::Buffer> buffers, vk::ArrayProxy<std::reference_wrapper<gfx::index_buffer<const uint16_t *>>> index_buffers, vk::ArrayProxy<vk::DescriptorSet> descriptor_sets, vk::ArrayProxy<const vk::DeviceSize> const &offsets);
+	template void pipeline::bind<const uint32_t *>(vk::CommandBuffer *buffer, vk::ArrayProxy<vk::Buffer> buffers, vk::ArrayProxy<std::reference_wrapper<gfx::index_buffer<const uint32_t *>>> index_buffers, vk::ArrayProxy<vk::DescriptorSet> descriptor_sets, vk::ArrayProxy<const vk::DeviceSize> const &offsets, vk::ArrayProxy<const uint32_t> const &dynamic_offsets);
+	template void pipeline::bind<const uint16_t *>(vk::CommandBuffer *buffer, vk::ArrayProxy<vk::Buffer> buffers, vk::ArrayProxy<std::reference_wrapper<gfx::index_buffer<const uint16_t *>>> index_buffers, vk::ArrayProxy<vk::DescriptorSet> descriptor_sets, vk::ArrayProxy<const vk::DeviceSize> const &offsets, vk::ArrayProxy<const uint32_t> const &dynamic_offsets);
 	template void pipeline::bind_vertex_buffer<gfx::vertex>(vk::VertexInputBindingDescription binding, std::vector<vk::VertexInputAttributeDescription> attributes);
 
 	void pipeline::create_graphics_pipeline()
 	{
+		VX_ZONE("pipeline::create_graphics_pipeline");
+
 		auto vert_code = gfx::read_file(vert_shader_name);
 		auto frag_code = gfx::read_file(frag_shader_name);
 
-		auto vertex_shader = this->create_shader_module(vert_code);
-		auto fragment_shader = this->create_shader_module(frag_code);
-
-		vk::PipelineShaderStageCreateInfo vertex_shader_stage_info({},
-			vk::ShaderStageFlagBits::eVertex, // stage
-			vertex_shader, // module
-			"main" // pName
-		);
-
-		vk::PipelineShaderStageCreateInfo fragment_shader_stage_info({},
-			vk::ShaderStageFlagBits::eFragment, // stage
-			fragment_shader, // module
-			"main" // pName
-		);
-
-		vk::PipelineShaderStageCreateInfo shader_stages[] = { fragment_shader_stage_info, vertex_shader_stage_info };
 		vk::PipelineVertexInputStateCreateInfo vertex_input_info({},
 			this->binding_descriptions.size(), // vertexBindingDescriptionCount
 			this->binding_descriptions.data(), // vertexBindingDescriptions
@@ -212,13 +478,83 @@ namespace gfx
 			{ 0.0f, 0.0f, 0.0f, 0.0f } // blendConstants (optional)
 		);
 
+		bool use_libraries = device->supports_pipeline_library();
+
+		// pipelines linked from libraries can't assume anything about the sets of the other libraries.
 		vk::PipelineLayoutCreateInfo pipeline_layout_info {
-			vk::PipelineLayoutCreateFlagBits::eIndependentSetsEXT,
+			use_libraries ? vk::PipelineLayoutCreateFlagBits::eIndependentSetsEXT : vk::PipelineLayoutCreateFlags {},
 			static_cast<uint32_t>(layouts.size()),
 			this->layouts.data(),
 		};
 
-		this->pipeline_layout = device->get_logical_device().createPipelineLayout(pipeline_layout_info);
+		gfx::pipeline_registry *registry = device->get_pipeline_registry();
+		this->pipeline_layout = registry->acquire_layout(pipeline_layout_info);
+
+		// everything the pipeline is created from. the viewport and scissor are dynamic, so they're left out, and the
+		// render pass is compared by handle, which is stricter than render pass compatibility but never wrong. every
+		// variable-length part is preceded by its length, so the bytes of two different states can't line up.
+		gfx::state_key key;
+		key.add(vert_code.size()).add(vert_code.data(), vert_code.size());
+		key.add(frag_code.size()).add(frag_code.data(), frag_code.size());
+		key.add(binding_descriptions.size()).add(attribute_descriptions.size()).add(dynamic_states.size());
+
+		for (const auto &binding : binding_descriptions)
+		{
+			key.add(binding);
+		}
+
+		for (const auto &attribute : attribute_descriptions)
+		{
+			key.add(attribute);
+		}
+
+		for (vk::DynamicState dynamic_state : dynamic_states)
+		{
+			key.add(dynamic_state);
+		}
+
+		key.add(input_assembly_info.topology).add(input_assembly_info.primitiveRestartEnable);
+		key.add(rasterizer.depthClampEnable).add(rasterizer.polygonMode).add(rasterizer.cullMode).add(rasterizer.frontFace);
+		key.add(rasterizer.depthBiasEnable).add(rasterizer.lineWidth);
+		key.add(multisampling.rasterizationSamples).add(color_blend_attachment).add(depth_stencil.has_value());
+
+		if (depth_stencil)
+		{
+			key.add(depth_stencil->depthTestEnable).add(depth_stencil->depthWriteEnable).add(depth_stencil->depthCompareOp);
+			key.add(depth_stencil->stencilTestEnable).add(depth_stencil->front).add(depth_stencil->back);
+		}
+
+		key.add(static_cast<VkPipelineLayout>(pipeline_layout)).add(static_cast<VkRenderPass>(render_pass));
+
+		this->state = std::move(key);
+
+		gfx::registered_pipeline registered = registry->acquire(state);
+		this->shared = registered.pipeline;
+
+		if (!registered.create)
+		{
+			// another pipeline has the same state, so this waits for that one instead of compiling it again.
+			this->vk_pipeline = shared.get();
+			spdlog::info("pipeline '{}' shares an existing pipeline with the same state", name);
+			return;
+		}
+
+		auto vertex_shader = this->create_shader_module(vert_code);
+		auto fragment_shader = this->create_shader_module(frag_code);
+
+		vk::PipelineShaderStageCreateInfo vertex_shader_stage_info({},
+			vk::ShaderStageFlagBits::eVertex, // stage
+			vertex_shader, // module
+			"main" // pName
+		);
+
+		vk::PipelineShaderStageCreateInfo fragment_shader_stage_info({},
+			vk::ShaderStageFlagBits::eFragment, // stage
+			fragment_shader, // module
+			"main" // pName
+		);
+
+		vk::PipelineShaderStageCreateInfo shader_stages[] = { fragment_shader_stage_info, vertex_shader_stage_info };
 
 		vk::GraphicsPipelineCreateInfo pipelineInfo {
 			{},
@@ -230,28 +566,58 @@ namespace gfx
 			&view_port_state_info,
 			&rasterizer,
 			&multisampling,
-			nullptr,
+			depth_stencil ? &*depth_stencil : nullptr,
 			&colorBlending,
 			&dynamic_state_info,
 			pipeline_layout,
 		};
 
 		pipelineInfo.subpass = 0;
-		pipelineInfo.renderPass = pass->pass;
+		pipelineInfo.renderPass = render_pass;
 		pipelineInfo.basePipelineHandle = nullptr;
 		pipelineInfo.basePipelineIndex = -1;
 
-		vk::Result result;
-		vk::Pipeline pipeline;
-
-		std::tie(result, pipeline) = device->get_logical_device().createGraphicsPipeline(nullptr, pipelineInfo);
+		auto start = std::chrono::steady_clock::now();
 
-		if (result != vk::Result::eSuccess)
+		// pipelines waiting on this one in the registry have to be told if it can't be created.
+		try
+		{
+			if (use_libraries)
+			{
+				this->create_from_libraries(pipelineInfo, vertex_shader_stage_info, fragment_shader_stage_info, registered.create);
+			}
+			else
+			{
+				vk::Result result;
+				vk::Pipeline pipeline;
+
+				std::tie(result, pipeline) = device->get_logical_device().createGraphicsPipeline(device->get_pipeline_cache(), pipelineInfo);
+
+				if (result != vk::Result::eSuccess)
+				{
+					throw std::runtime_error("unable to make pipeline");
+				}
+
+				this->vk_pipeline = pipeline;
+				registered.create->set_value(pipeline);
+			}
+		} catch (...)
 		{
-			throw std::runtime_error("unable to make pipeline");
+			device->get_logical_device().destroyShaderModule(fragment_shader);
+			device->get_logical_device().destroyShaderModule(vertex_shader);
+
+			registered.create->set_exception(std::current_exception());
+			throw;
 		}
 
-		this->vk_pipeline = pipeline;
+		// with a cold cache this is where the shaders are compiled, so this is the number a warm cache should bring down.
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		spdlog::info("created pipeline '{}' in {:.2f} ms ({} pipeline cache, {})",
+			name,
+			milliseconds,
+			device->is_pipeline_cache_warm() ? "warm" : "cold",
+			!use_libraries ? "monolithic" : optimized.valid() ? "fast-linked" : "linked");
 
 		device->get_logical_device().destroyShaderModule(vertex_shader);
 		device->get_logical_device().destroyShaderModule(fragment_shader);
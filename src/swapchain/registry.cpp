@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <deletion.h>
+#include <device.h>
+#include <spdlog/spdlog.h>
+#include <swapchain/registry.h>
+
+namespace gfx
+{
+	pipeline_registry::pipeline_registry(gfx::device *device)
+		: device { device }
+	{
+	}
+
+	pipeline_registry::~pipeline_registry()
+	{
+		if (!pipelines.empty() || !layouts.empty())
+		{
+			spdlog::warn("destroying {} pipelines and {} pipeline layouts that were never released", pipelines.size(), layouts.size());
+		}
+
+		for (auto &[state, entry] : pipelines)
+		{
+			this->destroy(entry, nullptr);
+		}
+
+		for (auto &[state, entry] : layouts)
+		{
+			device->get_logical_device().destroyPipelineLayout(entry.layout);
+		}
+	}
+
+	gfx::registered_pipeline pipeline_registry::acquire(const gfx::state_key &state)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = pipelines.find(state);
+
+		if (found != pipelines.end())
+		{
+			found->second.references++;
+			return gfx::registered_pipeline { found->second.pipeline, nullptr };
+		}
+
+		// the entry is added before the pipeline exists, so requests for the same state made while it's being created
+		// wait for it instead of creating it again.
+		auto create = std::make_shared<std::promise<vk::Pipeline>>();
+		std::shared_future<vk::Pipeline> pipeline = create->get_future().share();
+
+		this->pipelines.emplace(state, pipeline_entry { pipeline, 1 });
+
+		return gfx::registered_pipeline { pipeline, create };
+	}
+
+	void pipeline_registry::release(const gfx::state_key &state, gfx::deletion_queue *deletion_queue)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = pipelines.find(state);
+
+		if (found == pipelines.end() || --found->second.references > 0)
+		{
+			return;
+		}
+
+		this->destroy(found->second, deletion_queue);
+		this->pipelines.erase(found);
+	}
+
+	vk::PipelineLayout pipeline_registry::acquire_layout(const vk::PipelineLayoutCreateInfo &info)
+	{
+		gfx::state_key key;
+		key.add(info.flags).add(info.setLayoutCount).add(info.pushConstantRangeCount);
+
+		for (uint32_t i = 0; i < info.setLayoutCount; i++)
+		{
+			key.add(static_cast<VkDescriptorSetLayout>(info.pSetLayouts[i]));
+		}
+
+		for (uint32_t i = 0; i < info.pushConstantRangeCount; i++)
+		{
+			key.add(info.pPushConstantRanges[i]);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		layout_entry &entry = layouts[std::move(key)];
+
+		if (!entry.layout)
+		{
+			entry.layout = device->get_logical_device().createPipelineLayout(info);
+		}
+
+		entry.references++;
+		return entry.layout;
+	}
+
+	void pipeline_registry::release_layout(vk::PipelineLayout layout, gfx::deletion_queue *deletion_queue)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = std::find_if(layouts.begin(), layouts.end(), [&](const auto &entry) { return entry.second.layout == layout; });
+
+		if (found == layouts.end() || --found->second.references > 0)
+		{
+			return;
+		}
+
+		if (deletion_queue)
+		{
+			deletion_queue->destroy(layout);
+		}
+		else
+		{
+			device->get_logical_device().destroyPipelineLayout(layout);
+		}
+
+		this->layouts.erase(found);
+	}
+
+	void pipeline_registry::destroy(const pipeline_entry &entry, gfx::deletion_queue *deletion_queue)
+	{
+		vk::Pipeline pipeline;
+
+		// whoever created the pipeline waits for it to be done before releasing it, so this doesn't block.
+		try
+		{
+			pipeline = entry.pipeline.get();
+		} catch (const std::exception &)
+		{
+			return;
+		}
+
+		if (deletion_queue)
+		{
+			deletion_queue->destroy(pipeline);
+		}
+		else
+		{
+			device->get_logical_device().destroyPipeline(pipeline);
+		}
+	}
+}
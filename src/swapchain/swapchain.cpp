@@ -1,4 +1,5 @@
 #include "global.h"
+#include <algorithm>
 #include <context.h>
 #include <swapchain/swapchain.h>
 #include <vulkan/vulkan_enums.hpp>
@@ -37,6 +38,9 @@ namespace gfx
 
 	void swapchain::initialize(GLFWwindow *window, vk::SurfaceKHR &surface)
 	{
+		this->window = window;
+		this->surface = &surface;
+
 		gfx::swapchain_support_details details = gfx::query_swapchain_support(device->get_physical_device(), surface);
 
 		this->extent = this->choose_swap_extent(details.capabilities, window);
@@ -44,17 +48,74 @@ namespace gfx
 		this->create_image_views();
 	}
 
-	void swapchain::create_swapchain(vk::SurfaceKHR &surface, gfx::swapchain_support_details details)
+	bool swapchain::recreate(gfx::deletion_queue *deletion_queue)
+	{
+		gfx::swapchain_support_details details = gfx::query_swapchain_support(device->get_physical_device(), *surface);
+		vk::Extent2D new_extent = this->choose_swap_extent(details.capabilities, window);
+
+		// a minimized window has no area, and a swapchain can't be created for it.
+		if (new_extent.width == 0 || new_extent.height == 0)
+		{
+			return false;
+		}
+
+		spdlog::info("recreating swapchain, {}x{} -> {}x{}", extent.width, extent.height, new_extent.width, new_extent.height);
+
+		vk::SwapchainKHR old_chain = this->chain;
+		vk::Format old_format = this->image_format;
+
+		// finishing a frame only means the present was queued, the presentation engine may still be reading an image of
+		// the old swapchain, so it can't be retired before its last present is done. that's waited for while it's still
+		// current. without present waits (or if the wait fails, which it does for an out of date swapchain), the present
+		// queue going idle is all we can go by.
+		const uint64_t timeout = 1'000'000'000;
+		bool waitable = device->supports_present_wait() && present_id >= first_present_id;
+
+		if (!waitable || device->wait_for_present_khr(old_chain, present_id, timeout) != vk::Result::eSuccess)
+		{
+			device->present_queue.waitIdle();
+		}
+
+		for (auto image_view : image_views)
+		{
+			deletion_queue->destroy(image_view);
+		}
+
+		this->extent = new_extent;
+		this->create_swapchain(*surface, details, old_chain);
+		this->create_image_views();
+
+		// its images may still be rendered to by the frames in flight, the views go first as they're pushed first.
+		deletion_queue->destroy(old_chain);
+
+		if (image_format != old_format)
+		{
+			spdlog::warn("swapchain format changed after recreation, render passes created for the old format are incompatible");
+		}
+
+		for (auto &[name, pass] : render_passes)
+		{
+			pass.recreate_frame_buffers(deletion_queue);
+		}
+
+		this->generation++;
+		this->out_of_date = false;
+		return true;
+	}
+
+	void swapchain::create_swapchain(vk::SurfaceKHR &surface, gfx::swapchain_support_details details, vk::SwapchainKHR old_chain)
 	{
 		auto surface_format = this->choose_swap_surface(details.formats);
-		auto present_mode = this->choose_present_mode(details.present_modes);
+		auto present_mode = this->choose_present_mode ? this->choose_present_mode(details.present_modes) : this->select_present_mode(details.present_modes);
 
 		this->image_format = surface_format.format;
 
 		auto image_usage = vk::ImageUsageFlagBits::eColorAttachment
 			| vk::ImageUsageFlagBits::eInputAttachment;
 
-		uint32_t image_count = std::max(details.capabilities.minImageCount + 1, details.capabilities.maxImageCount);
+		uint32_t image_count = this->select_image_count(details.capabilities, present_mode);
+
+		spdlog::info("creating swapchain with {} images, present mode {}", image_count, vk::to_string(present_mode));
 
 		vk::SwapchainCreateInfoKHR create_info({}, surface, image_count, surface_format.format, surface_format.colorSpace, extent, 1, image_usage);
 		gfx::queue_family_indices indices = device->find_queue_families(&surface, device->get_physical_device());
@@ -79,9 +140,83 @@ namespace gfx
 		create_info.setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque);
 		create_info.setPresentMode(present_mode);
 		create_info.setClipped(true);
+		create_info.setOldSwapchain(old_chain);
 
 		this->chain = device->get_logical_device().createSwapchainKHR(create_info);
 		this->images = device->get_logical_device().getSwapchainImagesKHR(chain);
+
+		this->first_present_id = present_id + 1;
+	}
+
+	gfx::present_mode swapchain::select_present_mode(const gfx::present_modes &available_present_modes)
+	{
+		std::vector<gfx::present_mode> preferred;
+
+		switch (policy)
+		{
+		case gfx::present_policy::low_latency:
+			preferred = { gfx::present_mode::eMailbox };
+			break;
+		case gfx::present_policy::vsync:
+			preferred = { gfx::present_mode::eFifoRelaxed };
+			break;
+		case gfx::present_policy::throughput:
+			preferred = { gfx::present_mode::eImmediate, gfx::present_mode::eMailbox };
+			break;
+		}
+
+		for (auto mode : preferred)
+		{
+			if (std::find(available_present_modes.begin(), available_present_modes.end(), mode) != available_present_modes.end())
+			{
+				return mode;
+			}
+		}
+
+		// fifo is the only mode every device has to support.
+		return gfx::present_mode::eFifo;
+	}
+
+	uint32_t swapchain::select_image_count(const vk::SurfaceCapabilitiesKHR &capabilities, gfx::present_mode present_mode)
+	{
+		// one more than the minimum, so we never have to wait on the presentation engine to release an image.
+		uint32_t image_count = capabilities.minImageCount + 1;
+
+		// mailbox needs a spare image to replace the queued one with, and throughput wants the GPU to never run out.
+		if (present_mode == gfx::present_mode::eMailbox || policy == gfx::present_policy::throughput)
+		{
+			image_count = std::max(image_count, 3u);
+		}
+
+		// a maximum of 0 means there is no limit.
+		if (capabilities.maxImageCount != 0)
+		{
+			image_count = std::min(image_count, capabilities.maxImageCount);
+		}
+
+		return image_count;
+	}
+
+	void swapchain::wait_for_present()
+	{
+		if (!device->supports_present_wait() || policy == gfx::present_policy::throughput)
+		{
+			return;
+		}
+
+		if (present_id < first_present_id + max_queued_presents)
+		{
+			return;
+		}
+
+		// a timeout keeps us from hanging if the display stops presenting, such as when the window is hidden.
+		const uint64_t timeout = 100'000'000;
+		vk::Result result = device->wait_for_present_khr(chain, present_id - max_queued_presents, timeout);
+
+		if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
+		{
+			this->out_of_date = true;
+		}
 	}
 
 	void swapchain::create_image_views()
@@ -164,15 +299,12 @@ namespace gfx
 		return render_pass(swapchain, samples, store_operation, load_operation, stencil_load_op, stencil_store_op, initial_layout, final_layout);
 	}
 
-	void render_pass::begin(vk::CommandBuffer *buffer, uint32_t index, vk::ClearValue clear)
+	void render_pass::begin(vk::CommandBuffer *buffer, uint32_t index, vk::ClearValue clear, vk::SubpassContents contents)
 	{
 		vk::Rect2D scissor {
 			{0, 0},
 			swapchain->extent
 		};
-		vk::Viewport viewport {
-			0.0f, 0.0f, static_cast<float>(swapchain->extent.width), static_cast<float>(swapchain->extent.height), 0.0f, 1.0f
-		};
 
 		vk::RenderPassBeginInfo render_pass_info {
 			this->pass,
@@ -182,7 +314,36 @@ namespace gfx
 			&clear,
 		};
 
-		buffer->beginRenderPass(render_pass_info, vk::SubpassContents::eInline);
+		// timestamps can't be written inside a pass that executes secondary command buffers, so they go around it.
+		if (swapchain->profiler)
+		{
+			this->profiler_scope = swapchain->profiler->begin_scope(*buffer, name.c_str());
+		}
+
+		buffer->beginRenderPass(render_pass_info, contents);
+
+		// the secondary command buffers have to set these themselves, the primary can't record anything else in the pass.
+		if (contents == vk::SubpassContents::eInline)
+		{
+			this->set_viewport(buffer);
+		}
+	}
+
+	vk::Extent2D render_pass::get_extent() const
+	{
+		return swapchain->extent;
+	}
+
+	void render_pass::set_viewport(vk::CommandBuffer *buffer)
+	{
+		vk::Rect2D scissor {
+			{0, 0},
+			swapchain->extent
+		};
+		vk::Viewport viewport {
+			0.0f, 0.0f, static_cast<float>(swapchain->extent.width), static_cast<float>(swapchain->extent.height), 0.0f, 1.0f
+		};
+
 		buffer->setViewport(0, viewport);
 		buffer->setScissor(0, scissor);
 	}
@@ -190,6 +351,12 @@ namespace gfx
 	void render_pass::end(vk::CommandBuffer *buffer)
 	{
 		buffer->endRenderPass();
+
+		if (swapchain->profiler)
+		{
+			swapchain->profiler->end_scope(*buffer, profiler_scope);
+			this->profiler_scope = gfx::gpu_profiler::invalid_scope;
+		}
 	}
 
 	void render_pass::cleanup()
@@ -241,6 +408,16 @@ namespace gfx
 		this->pass = device->get_logical_device().createRenderPass(info);
 	}
 
+	void render_pass::recreate_frame_buffers(gfx::deletion_queue *deletion_queue)
+	{
+		for (auto framebuffer : framebuffers)
+		{
+			deletion_queue->destroy(framebuffer);
+		}
+
+		this->create_frame_buffers();
+	}
+
 	void render_pass::create_frame_buffers()
 	{
 		framebuffers.resize(swapchain->images.size());
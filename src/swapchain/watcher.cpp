@@ -0,0 +1,197 @@
+#include <chrono>
+#include <cstring>
+#include <debug/zones.h>
+#include <spdlog/spdlog.h>
+#include <swapchain/watcher.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace gfx
+{
+	shader_watcher::shader_watcher(gfx::thread_pool &pool)
+		: pool { pool }
+	{
+#ifdef __linux__
+		this->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+		if (inotify < 0)
+		{
+			spdlog::warn("unable to create an inotify instance, shaders won't be hot-reloaded: {}", std::strerror(errno));
+			return;
+		}
+
+		// large enough for a burst of events, a single event is at most sizeof(inotify_event) + NAME_MAX + 1 bytes.
+		this->events.resize(64 * 1024);
+#else
+		spdlog::warn("shader hot-reloading is only supported on linux");
+#endif
+	}
+
+	shader_watcher::~shader_watcher()
+	{
+		for (auto &[pipeline, pending] : rebuilds)
+		{
+			if (pending.ready.valid())
+			{
+				pending.ready.wait();
+			}
+		}
+
+		this->rebuilds.clear();
+
+#ifdef __linux__
+		if (inotify >= 0)
+		{
+			close(inotify);
+		}
+#endif
+	}
+
+	void shader_watcher::watch(gfx::pipeline *pipeline)
+	{
+		watched_pipeline watched {
+			pipeline,
+			std::filesystem::absolute(pipeline->get_vert_shader_name()).lexically_normal(),
+			std::filesystem::absolute(pipeline->get_frag_shader_name()).lexically_normal(),
+		};
+
+		this->watch_directory(watched.vert_shader);
+		this->watch_directory(watched.frag_shader);
+
+		this->pipelines.push_back(std::move(watched));
+	}
+
+	void shader_watcher::watch_directory(const std::filesystem::path &file)
+	{
+#ifdef __linux__
+		if (inotify < 0)
+		{
+			return;
+		}
+
+		std::filesystem::path directory = file.parent_path();
+
+		// compilers either write the file in place or write a temporary file and rename it over the old one.
+		int descriptor = inotify_add_watch(inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+
+		if (descriptor < 0)
+		{
+			spdlog::warn("unable to watch {} for shader changes: {}", directory.string(), std::strerror(errno));
+			return;
+		}
+
+		// watching the same directory again hands out the same descriptor.
+		if (directories.emplace(descriptor, directory).second)
+		{
+			spdlog::info("watching {} for shader changes", directory.string());
+		}
+#endif
+	}
+
+	void shader_watcher::update(gfx::deletion_queue *deletion_queue)
+	{
+		VX_ZONE("shader_watcher::update");
+
+#ifdef __linux__
+		ssize_t size;
+
+		// the descriptor is non-blocking, so this returns right away if nothing has changed.
+		while (inotify >= 0 && (size = read(inotify, events.data(), events.size())) > 0)
+		{
+			for (ssize_t offset = 0; offset < size;)
+			{
+				const auto *event = reinterpret_cast<const inotify_event *>(events.data() + offset);
+				offset += sizeof(inotify_event) + event->len;
+
+				auto directory = directories.find(event->wd);
+
+				if (event->len == 0 || directory == directories.end())
+				{
+					continue;
+				}
+
+				std::filesystem::path changed = directory->second / event->name;
+
+				for (const watched_pipeline &watched : pipelines)
+				{
+					if (watched.vert_shader == changed || watched.frag_shader == changed)
+					{
+						spdlog::info("{} changed, rebuilding pipeline '{}'", changed.string(), watched.pipeline->name);
+						this->start_rebuild(watched.pipeline);
+					}
+				}
+			}
+		}
+#endif
+
+		for (auto it = rebuilds.begin(); it != rebuilds.end();)
+		{
+			auto &[pipeline, pending] = *it;
+
+			if (pending.ready.valid())
+			{
+				if (pending.ready.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				{
+					it++;
+					continue;
+				}
+
+				try
+				{
+					pending.ready.get();
+				} catch (const std::exception &error)
+				{
+					spdlog::error("unable to rebuild pipeline '{}', keeping the old one: {}", pipeline->name, error.what());
+					pending.replacement.reset();
+				}
+			}
+
+			// the replacement is kept until the pipeline can take it over, see [pipeline::replace_with].
+			if (pending.replacement)
+			{
+				if (!pipeline->replace_with(*pending.replacement, deletion_queue))
+				{
+					it++;
+					continue;
+				}
+
+				spdlog::info("reloaded pipeline '{}'", pipeline->name);
+				pending.replacement.reset();
+			}
+
+			if (pending.again)
+			{
+				this->submit_rebuild(pipeline, pending);
+				it++;
+				continue;
+			}
+
+			it = rebuilds.erase(it);
+		}
+	}
+
+	void shader_watcher::start_rebuild(gfx::pipeline *pipeline)
+	{
+		auto [pending, inserted] = rebuilds.try_emplace(pipeline);
+
+		if (!inserted)
+		{
+			pending->second.again = true;
+			return;
+		}
+
+		this->submit_rebuild(pipeline, pending->second);
+	}
+
+	void shader_watcher::submit_rebuild(gfx::pipeline *pipeline, rebuild &pending)
+	{
+		pending.replacement = pipeline->create_replacement();
+		pending.again = false;
+
+		gfx::pipeline *replacement = pending.replacement.get();
+		pending.ready = pool.submit([replacement]() { replacement->create_graphics_pipeline(); });
+	}
+}
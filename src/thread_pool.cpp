@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <spdlog/spdlog.h>
+#include <thread_pool.h>
+
+namespace gfx
+{
+	thread_pool::thread_pool(uint32_t threads)
+	{
+		// hardware_concurrency may return 0 if it can't tell.
+		threads = std::max(threads, 1u);
+
+		for (uint32_t i = 0; i < threads; i++)
+		{
+			this->threads.emplace_back(&thread_pool::run, this);
+		}
+
+		spdlog::info("started {} pool threads", threads);
+	}
+
+	thread_pool::~thread_pool()
+	{
+		spdlog::info("cleaning up gfx::thread_pool");
+
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+
+		job_ready.notify_all();
+
+		for (auto &thread : threads)
+		{
+			thread.join();
+		}
+
+		spdlog::info("... done!");
+	}
+
+	void thread_pool::run()
+	{
+		while (true)
+		{
+			std::function<void()> job;
+
+			{
+				std::unique_lock lock(mutex);
+				job_ready.wait(lock, [&]() { return stopping || !jobs.empty(); });
+
+				// the queue is drained before stopping, so no future is left without a result.
+				if (jobs.empty())
+				{
+					return;
+				}
+
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			// packaged tasks store exceptions in their future, so nothing escapes the job.
+			job();
+		}
+	}
+}